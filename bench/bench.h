@@ -0,0 +1,47 @@
+/**
+ * @Brief Minimal benchmark harness for the host benchmarks.
+ *
+ * A benchmark measures the simulated cycles of an operation and reports
+ * them with BENCH_CHECK( ), which fails the benchmark if they exceed a
+ * threshold, so that CTest catches regressions. BENCH_RUN( ) resets the
+ * simulator and runs a benchmark function; main( ) returns
+ * BENCH_RESULT( ). The cycle counts are estimates of the simulator, see
+ * sim/sim.h: they compare versions of the library, not MSP430 code. The
+ * thresholds are the counts measured when set, plus about 10%, with
+ * INSTRUMENT_ENABLE 0, see instrument.h.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int bench_failures;
+
+/** Reports a measurement, and fails the benchmark if above limit. */
+#define BENCH_CHECK( name, value, limit )											\
+	do {																			\
+		unsigned long long _bench_v = ( unsigned long long )( value );				\
+		unsigned long long _bench_l = ( unsigned long long )( limit );				\
+		printf( "  %-36s %8llu   (limit %llu)%s\n", name, _bench_v, _bench_l,		\
+			_bench_v > _bench_l ? "  FAIL" : "" );									\
+		bench_failures += _bench_v > _bench_l;										\
+	} while( 0 )
+
+/** Resets the simulator and runs a benchmark function. */
+#define BENCH_RUN( bench )															\
+	do {																			\
+		printf( "%s\n", #bench );													\
+		sim_reset( );																\
+		bench( );																	\
+	} while( 0 )
+
+/** Exit status of the benchmark program. */
+#define BENCH_RESULT( )	( bench_failures ? EXIT_FAILURE : EXIT_SUCCESS )
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Cycles of calculate_checksum( ) of checksum.c.
+ */
+#include "checksum.h"
+
+#include "bench.h"
+
+static void bench_checksum( void )
+{
+	static const int sizes[] = { 1, 16, 256 };
+	static const uint32_t limits[] = { 12, 45, 570 };
+	static uint8_t buffer[256];
+	char name[40];
+	unsigned int i;
+
+	for( i = 0; i < sizeof( buffer ); i++ )
+		buffer[i] = ( uint8_t )i;
+
+	for( i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); i++ )
+	{
+		uint64_t cycles = sim_getCycles( );
+		calculate_checksum( buffer, sizes[i] );
+		cycles = sim_getCycles( ) - cycles;
+
+		snprintf( name, sizeof( name ), "%d bytes", sizes[i] );
+		BENCH_CHECK( name, cycles, limits[i] );
+	}
+}
+
+int main( void )
+{
+	BENCH_RUN( bench_checksum );
+
+	return BENCH_RESULT( );
+}
@@ -0,0 +1,46 @@
+/*
+ * Cost of delay_us( ) of delay.c: the cycles of a delay too short to
+ * wait, and the error of the delays, in nsec.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "delay.h"
+#include <msp430.h>
+
+#include "bench.h"
+
+static void bench_delayUs( void )
+{
+	static const unsigned int delays[] = { 10, 100, 1000 };
+	static const uint32_t limits[] = { 5200, 8000, 7000 };
+	uint64_t cycles, time;
+	char name[40];
+	unsigned int i;
+
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	timer_init( SMCLK, 1 );
+
+	cycles = sim_getCycles( );
+	delay_us( 0 );
+	BENCH_CHECK( "0 usec, cycles", sim_getCycles( ) - cycles, 33 );
+
+	/* Without the timer interrupt, which would extend the delays. */
+	for( i = 0; i < sizeof( delays ) / sizeof( delays[0] ); i++ )
+	{
+		time = sim_getTime( );
+		delay_us( delays[i] );
+		time = sim_getTime( ) - time;
+
+		snprintf( name, sizeof( name ), "%u usec, nsec error", delays[i] );
+		BENCH_CHECK( name, llabs( ( long long )time - delays[i] * 1000LL ), limits[i] );
+	}
+
+	timer_uninit( );
+}
+
+int main( void )
+{
+	BENCH_RUN( bench_delayUs );
+
+	return BENCH_RESULT( );
+}
@@ -0,0 +1,100 @@
+/*
+ * Cycles per byte of Fifo_push( ) and Fifo_pop( ) of fifo.c, and of the
+ * consumer side: draining a FIFO a byte at a time with Fifo_get( ),
+ * against the span API, Fifo_peekSpan( ) and Fifo_commit( ), which takes
+ * the bytes in place. Reports the bytes per second at the MCLK of the
+ * benchmark. The bytes wrap around the
+ * end of the buffer, so the span API takes two spans. This file is
+ * hooked like the library, so that the reads of the consumer are
+ * charged in both cases.
+ */
+#include "fifo.h"
+
+#include "bench.h"
+
+#define BENCH_FIFO_SIZE		256
+#define BENCH_MCLK			4900000ULL	/* DCO_FREQ_4900KHz */
+
+FIFO_DEFINE( bench_fifo, BENCH_FIFO_SIZE );
+
+/** Fills the FIFO, with the bytes wrapping around the end of the buffer. */
+static void bench_fill( void )
+{
+	unsigned int i;
+
+	Fifo_init( &bench_fifo, bench_fifo_buffer, BENCH_FIFO_SIZE );
+	bench_fifo.wpos = bench_fifo.rpos = BENCH_FIFO_SIZE / 3;
+
+	for( i = 0; i < BENCH_FIFO_SIZE; i++ )
+		Fifo_push( &bench_fifo, ( uint8_t )i );
+}
+
+/** Reports the cycles to drain the FIFO, and the bytes per second. */
+static void bench_report( const char* name, uint64_t cycles, uint64_t limit )
+{
+	BENCH_CHECK( name, cycles, limit );
+	printf( "    %llu bytes/s at 4.9 MHz\n", BENCH_MCLK * BENCH_FIFO_SIZE / cycles );
+}
+
+static void bench_pushPop( void )
+{
+	uint64_t cycles;
+	unsigned int i, sum = 0;
+
+	printf( "  (per byte: the simulator does not charge loop control)\n" );
+
+	Fifo_init( &bench_fifo, bench_fifo_buffer, BENCH_FIFO_SIZE );
+
+	cycles = sim_getCycles( );
+	for( i = 0; i < BENCH_FIFO_SIZE; i++ )
+		Fifo_push( &bench_fifo, ( uint8_t )i );
+	BENCH_CHECK( "Fifo_push, per byte", ( sim_getCycles( ) - cycles ) / BENCH_FIFO_SIZE, 33 );
+
+	cycles = sim_getCycles( );
+	for( i = 0; i < BENCH_FIFO_SIZE; i++ )
+		sum += Fifo_pop( &bench_fifo );
+	BENCH_CHECK( "Fifo_pop, per byte", ( sim_getCycles( ) - cycles ) / BENCH_FIFO_SIZE, 29 );
+
+	if( sum != BENCH_FIFO_SIZE * ( BENCH_FIFO_SIZE - 1 ) / 2 )
+		BENCH_CHECK( "bytes lost", 1, 0 );
+}
+
+static void bench_drain( void )
+{
+	const uint8_t* span;
+	uint64_t cycles;
+	uint16_t n;
+	uint8_t byte;
+	unsigned int sum = 0;
+
+	/* Per byte. */
+	bench_fill( );
+	cycles = sim_getCycles( );
+	while( Fifo_get( &bench_fifo, &byte ) )
+		sum += byte;
+	bench_report( "Fifo_get, 256 bytes", sim_getCycles( ) - cycles, 8460 );
+
+	/* Per span, parsed in place. */
+	bench_fill( );
+	cycles = sim_getCycles( );
+	while( ( n = Fifo_peekSpan( &bench_fifo, &span ) ) != 0 )
+	{
+		uint16_t i;
+		for( i = 0; i < n; i++ )
+			sum += span[i];
+		Fifo_commit( &bench_fifo, n );
+	}
+	bench_report( "Fifo_peekSpan/commit, 256 bytes", sim_getCycles( ) - cycles, 710 );
+
+	/* Both read every byte. */
+	if( sum != 2 * ( BENCH_FIFO_SIZE * ( BENCH_FIFO_SIZE - 1 ) / 2 ) )
+		BENCH_CHECK( "bytes lost", 1, 0 );
+}
+
+int main( void )
+{
+	BENCH_RUN( bench_pushPop );
+	BENCH_RUN( bench_drain );
+
+	return BENCH_RESULT( );
+}
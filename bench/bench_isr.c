@@ -0,0 +1,138 @@
+/*
+ * Cycles of the interrupt handlers: the TimerA tick of timer.c, with
+ * and without timers expiring and with 1 to 1000 active timers, and a
+ * pin interrupt of gpio.c.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "gpio.h"
+#include <msp430.h>
+
+#include "bench.h"
+
+static void bench_expired( void* user )
+{
+	( void )user;
+}
+
+/** Sleeps for msec, and returns the cycles executed by the interrupts. */
+static uint64_t bench_sleep( int msec )
+{
+	static timer_t wakeup;
+	uint64_t cycles;
+
+	wakeup.mode = TIMER_MODE_ONESHOT | TIMER_MODE_WAKEUP;
+	wakeup.period_msec = msec;
+	wakeup.callback = NULL;
+	timer_start( &wakeup );
+
+	cycles = sim_getCycles( );
+	__bis_SR_register( LPM0_bits | GIE );
+	return sim_getCycles( ) - cycles;
+}
+
+static void bench_timerTick( void )
+{
+	static timer_t timers[8];
+	uint32_t irqs;
+	uint64_t cycles;
+	int i;
+
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	timer_init( SMCLK, 1 );
+
+	/* Idle ticks. */
+	irqs = sim_getIrqCount( TIMERA0_VECTOR );
+	cycles = bench_sleep( 1000 );
+	irqs = sim_getIrqCount( TIMERA0_VECTOR ) - irqs;
+	BENCH_CHECK( "tick, no timer expiring", cycles / irqs, 75 );
+
+	/* Every tick expires a timer. */
+	for( i = 0; i < 8; i++ )
+	{
+		timers[i].mode = TIMER_MODE_PERIODIC;
+		timers[i].period_msec = 8;
+		timers[i].callback = bench_expired;
+		timer_start( &timers[i] );
+		bench_sleep( 1 );
+	}
+
+	irqs = sim_getIrqCount( TIMERA0_VECTOR );
+	cycles = bench_sleep( 1000 );
+	irqs = sim_getIrqCount( TIMERA0_VECTOR ) - irqs;
+	BENCH_CHECK( "tick, a timer expiring", cycles / irqs, 210 );
+
+	for( i = 0; i < 8; i++ )
+		timer_stop( &timers[i] );
+	timer_uninit( );
+}
+
+static void bench_timerScaling( void )
+{
+	static const struct
+	{
+		int count;
+		unsigned int limit;
+	} steps[] = { { 1, 70 }, { 10, 77 }, { 100, 140 }, { 1000, 770 } };
+	static timer_t timers[1000];
+	char name[40];
+	uint32_t irqs;
+	uint64_t cycles;
+	unsigned int i;
+	int started = 0;
+
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	timer_init( SMCLK, 1 );
+
+	/* The periods differ, so the expiries spread over the slots: about
+	 * a timer expires per tick with 1000 timers, and a slot holds about
+	 * 1 / TIMER_WHEEL_SIZE of them. */
+	for( i = 0; i < sizeof( steps ) / sizeof( steps[0] ); i++ )
+	{
+		for( ; started < steps[i].count; started++ )
+		{
+			timers[started].mode = TIMER_MODE_PERIODIC;
+			timers[started].period_msec = 1000 + started;
+			timers[started].callback = bench_expired;
+			timer_start( &timers[started] );
+		}
+
+		irqs = sim_getIrqCount( TIMERA0_VECTOR );
+		cycles = bench_sleep( 1000 );
+		irqs = sim_getIrqCount( TIMERA0_VECTOR ) - irqs;
+
+		snprintf( name, sizeof( name ), "tick, active timers: %d", steps[i].count );
+		BENCH_CHECK( name, cycles / irqs, steps[i].limit );
+	}
+
+	for( i = 0; i < 1000; i++ )
+		timer_stop( &timers[i] );
+	timer_uninit( );
+}
+
+static void bench_pinInterrupt( void )
+{
+	uint64_t cycles;
+
+	GPIO_mode( 1, 5, INPUT );
+	GPIO_attachInterrupt( 1, 5, NULL, FALLING );
+	sim_setPin( 1, 5, 1 );
+	__enable_interrupt( );
+
+	cycles = sim_getCycles( );
+	sim_setPin( 1, 5, 0 );
+	sim_run( 1 );
+	cycles = sim_getCycles( ) - cycles - 1;
+	BENCH_CHECK( "pin interrupt", cycles, 55 );
+
+	GPIO_detachInterrupt( 1, 5 );
+}
+
+int main( void )
+{
+	BENCH_RUN( bench_timerTick );
+	BENCH_RUN( bench_timerScaling );
+	BENCH_RUN( bench_pinInterrupt );
+
+	return BENCH_RESULT( );
+}
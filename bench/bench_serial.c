@@ -0,0 +1,64 @@
+/*
+ * Cycles per byte of the receive interrupt of serial.c,
+ * Serial_UART0_IRQ( ), which stores each character in the receive FIFO.
+ * The handler is timed from the vector, so the count excludes the
+ * interrupt entry and exit.
+ */
+#include "clock.h"
+#include "serial.h"
+#include <msp430.h>
+
+#include "bench.h"
+
+#define BENCH_BYTES		64
+
+/* The handler of serial.c, installed by the simulator. */
+extern void Serial_UART0_IRQ( void );
+
+static uint64_t bench_irqCycles;
+
+/** Times the receive handler of UART0. */
+static void bench_rxIrq( void )
+{
+	uint64_t cycles = sim_getCycles( );
+	Serial_UART0_IRQ( );
+	bench_irqCycles += sim_getCycles( ) - cycles;
+}
+
+static void bench_receive( void )
+{
+	static uint8_t data[BENCH_BYTES];
+	uint32_t irqs;
+	int i;
+
+	for( i = 0; i < BENCH_BYTES; i++ )
+		data[i] = ( uint8_t )i;
+
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	serial_init( 0, CHAR_8BIT, 115200, SMCLK );
+	sim_uartSetBaud( 0, 115200 );
+	sim_setVector( USART0RX_VECTOR, bench_rxIrq );
+	__enable_interrupt( );
+
+	printf( "  (per byte: the simulator does not charge loop control)\n" );
+
+	bench_irqCycles = 0;
+	irqs = sim_getIrqCount( USART0RX_VECTOR );
+	sim_uartSend( 0, data, BENCH_BYTES );
+	sim_runFor( BENCH_BYTES * 100 + 1000 );
+	irqs = sim_getIrqCount( USART0RX_VECTOR ) - irqs;
+
+	if( irqs != BENCH_BYTES || serial_available( 0 ) != BENCH_BYTES )
+		BENCH_CHECK( "bytes lost", 1, 0 );
+	BENCH_CHECK( "Serial_UART0_IRQ, per byte", bench_irqCycles / BENCH_BYTES, 52 );
+
+	sim_setVector( USART0RX_VECTOR, NULL );
+	serial_uninit( 0 );
+}
+
+int main( void )
+{
+	BENCH_RUN( bench_receive );
+
+	return BENCH_RESULT( );
+}
@@ -0,0 +1,40 @@
+/*
+ * Cycles of the SPI frame transfers of spi.c, at the fastest SPI clock,
+ * where the loops rather than the bus limit the throughput.
+ */
+#include "clock.h"
+#include "spi.h"
+
+#include "bench.h"
+
+#define BENCH_FRAME_SIZE	64
+
+static void bench_frames( void )
+{
+	static uint8_t out[BENCH_FRAME_SIZE], in[BENCH_FRAME_SIZE];
+	uint64_t cycles;
+
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	SPI_init( 1, SPI_MODE0, 2450000, SMCLK );
+
+	cycles = sim_getCycles( );
+	SPI_transferFrame( 1, in, out, BENCH_FRAME_SIZE );
+	BENCH_CHECK( "transferFrame, 64 bytes", sim_getCycles( ) - cycles, 1150 );
+
+	cycles = sim_getCycles( );
+	SPI_transmitFrame( 1, out, BENCH_FRAME_SIZE );
+	BENCH_CHECK( "transmitFrame, 64 bytes", sim_getCycles( ) - cycles, 1150 );
+
+	cycles = sim_getCycles( );
+	SPI_receiveFrame( 1, in, BENCH_FRAME_SIZE );
+	BENCH_CHECK( "receiveFrame, 64 bytes", sim_getCycles( ) - cycles, 1150 );
+
+	SPI_uninit( 1 );
+}
+
+int main( void )
+{
+	BENCH_RUN( bench_frames );
+
+	return BENCH_RESULT( );
+}
@@ -1,20 +1,58 @@
 #include "clock.h"
+#include "critical.h"
+#include "timer.h"
 #include <msp430.h>
 
-#define WAIT_CRYSTAL( )														\
-	do {																	\
-		int i;																\
-		do {																\
-			IFG1 &= ~OFIFG;                  /* Clear OSCFault flag  */		\
-			for( i = 0xff; i > 0; i-- )      /* Time for flag to set */		\
-				__nop();													\
-		}  while( ( IFG1 & OFIFG ) != 0 );   /* OSCFault flag still set? */	\
-	} while( 0 )
+/** Number of ACLK periods the DCO is counted over, per calibration step. */
+#ifndef CLOCK_DCO_CAL_ACLK_CYCLES
+#define CLOCK_DCO_CAL_ACLK_CYCLES		16
+#endif
+
+/** Maximum number of DCO calibration steps, after the coarse search. */
+#ifndef CLOCK_DCO_CAL_MAX_ITERATIONS
+#define CLOCK_DCO_CAL_MAX_ITERATIONS	64
+#endif
+
+/**
+ * Polls of the ACLK capture flag before ACLK is deemed stopped, during
+ * DCO calibration. An ACLK period of a 32 kHz crystal divided by 8 takes
+ * about 400 polls at the fastest DCO setting.
+ */
+#ifndef CLOCK_DCO_CAL_TIMEOUT
+#define CLOCK_DCO_CAL_TIMEOUT			1000
+#endif
 
 static uint32_t clock_XT1FreqHz;
 static uint32_t clock_XT2FreqHz;
 static uint32_t clock_DCOFreqHz;
 
+/* Snapshot of the clock frequencies, updated by clock_update( ). */
+static uint32_t clock_ACLKFreqHz;
+static uint32_t clock_MCLKFreqHz;
+static uint32_t clock_SMCLKFreqHz;
+static uint16_t clock_version;
+
+static clock_listener_t* clock_listeners;
+
+/* Clock source changes waiting for a crystal, see clock_poll( ). */
+static struct
+{
+	clock_source_t source;
+	uint8_t divider;
+} clock_pendingMCLK, clock_pendingSMCLK;
+static uint8_t clock_pending;		/* MCLK and/or SMCLK */
+static unsigned long clock_pollStart;	/* timer_millis( ) when the crystal was started */
+static volatile uint8_t clock_crystalStatus;
+
+static void clock_prepare( void );
+static void clock_update( void );
+
+static void clock_configDCO( uint32_t dco_freq );
+static int clock_crystalFault( void );
+static void clock_pend( clock_t clk, clock_source_t source, uint8_t divider );
+static uint16_t clock_measureDCO( void );
+static int clock_waitACLK( void );
+static void clock_setDCOCode( uint16_t code );
 static void clock_configACLK( uint8_t divider );
 static void clock_configMCLK( clock_source_t source, uint8_t divider );
 static void clock_configSMCLK( clock_source_t source, uint8_t divider );
@@ -26,7 +64,6 @@ void clock_init( uint32_t xt1_freq, uint32_t xt2_freq, uint32_t dco_freq )
 {
 	clock_XT1FreqHz = xt1_freq;
 	clock_XT2FreqHz = xt2_freq;
-	clock_DCOFreqHz = dco_freq;
 
 	/* Enable High Freq mode for XT1. */
 	if( clock_XT1FreqHz >= 450000 )
@@ -38,87 +75,461 @@ void clock_init( uint32_t xt1_freq, uint32_t xt2_freq, uint32_t dco_freq )
 	else
 		BCSCTL1 &= ~XT2OFF;
 
+	clock_configDCO( dco_freq );
+
+	clock_update( );
+}
+
+void clock_set( clock_t clk, clock_source_t source, uint8_t divider )
+{
+	clock_prepare( );
+
+	critical_state_t state = critical_enter( );
+
+	switch( clk )
+	{
+	case ACLK:
+		clock_configACLK( divider );
+		break;
+
+	case MCLK:
+	case SMCLK:
+		clock_pend( clk, source, divider );
+		break;
+
+	default:
+		break;
+	}
+
+	clock_update( );
+
+	critical_exit( state );
+
+	/* Start checking the crystal. */
+	clock_poll( );
+}
+
+int clock_poll( void )
+{
+	if( !clock_pending )
+		return clock_crystalStatus;
+
+	if( !clock_crystalFault( ) )
+	{
+		clock_prepare( );
+
+		critical_state_t state = critical_enter( );
+
+		/* Switch to the crystal and watch for faults. */
+		if( clock_pending & MCLK )
+			clock_configMCLK( clock_pendingMCLK.source, clock_pendingMCLK.divider );
+		if( clock_pending & SMCLK )
+			clock_configSMCLK( clock_pendingSMCLK.source, clock_pendingSMCLK.divider );
+
+		clock_pending = 0;
+		clock_crystalStatus = CLOCK_CRYSTAL_STABLE;
+		IE1 |= OFIE;
+		clock_update( );
+
+		critical_exit( state );
+	}
+	else if( timer_millis( ) - clock_pollStart > CLOCK_CRYSTAL_TIMEOUT_MSEC )
+	{
+		/* Give up and stay on the current source. */
+		clock_pending = 0;
+		clock_crystalStatus = CLOCK_CRYSTAL_FAULT;
+	}
+
+	return clock_crystalStatus;
+}
+
+int clock_getCrystalStatus( void )
+{
+	return clock_crystalStatus;
+}
+
+void clock_setPerformanceLevel( uint32_t dco_freq, uint8_t mclk_divider, uint8_t smclk_divider )
+{
+	clock_prepare( );
+
+	critical_state_t state = critical_enter( );
+
+	clock_configDCO( dco_freq );
+	clock_configMCLK( DCO, mclk_divider );
+	clock_configSMCLK( DCO, smclk_divider );
+
+	/* Supersedes a pending switch to a crystal, which
+	 * clock_poll( ) would otherwise make later. */
+	if( clock_pending )
+	{
+		clock_pending = 0;
+		clock_crystalStatus = CLOCK_CRYSTAL_STABLE;
+	}
+
+	/* Retime the peripherals before any interrupt
+	 * observes the new frequencies. */
+	clock_update( );
+
+	critical_exit( state );
+}
+
+uint32_t clock_calibrateDCO( uint32_t target )
+{
+	uint16_t tactl = TACTL;
+	uint16_t tacctl2 = TACCTL2;
+	uint8_t bcsctl2 = BCSCTL2;
+	uint16_t compare, delta, error, code, bit;
+	uint16_t best_delta = 0, best_error = 0xFFFF;
+	uint8_t dcoctl = DCOCTL, rsel = BCSCTL1 & 0x07;
+	uint8_t best_dcoctl = dcoctl, best_rsel = rsel;
+	int i;
+
+	/* ACLK is the reference, so XT1 must be running. */
+	if( clock_ACLKFreqHz == 0 || clock_crystalFault( ) )
+		return 0;
+
+	/* SMCLK is retuned while measuring. */
+	clock_prepare( );
+	critical_state_t state = critical_enter( );
+
+	/* SMCLK counts expected in the measurement window. */
+	compare = ( target * CLOCK_DCO_CAL_ACLK_CYCLES ) / clock_ACLKFreqHz;
+
+	/* Clock SMCLK from the undivided DCO. */
+	__bic_SR_register( SCG0 );
+	BCSCTL2 &= ~( SELS | DIVS_3 );
+
+	/* Count SMCLK with TimerA and capture on the rising edges of ACLK (CCI2B). */
+	TACCTL2 = CM_1 | CCIS_1 | CAP;
+	TACTL = TASSEL_2 | MC_2;
+
+	/* Coarse search: successive approximation over RSEL, DCO and MOD,
+	 * which land near the target, as the frequency mostly increases
+	 * with each of them.
+	 */
+	code = 0;
+	for( bit = 0x400; bit; bit >>= 1 )
+	{
+		clock_setDCOCode( code | bit );
+		delta = clock_measureDCO( );
+		if( delta == 0 )
+			break;
+		if( delta <= compare )
+			code |= bit;
+	}
+	clock_setDCOCode( code );
+
+	/* Fine search: step towards the target. */
+	for( i = 0; delta && i < CLOCK_DCO_CAL_MAX_ITERATIONS; i++ )
+	{
+		delta = clock_measureDCO( );
+		if( delta == 0 )
+			break;
+
+		error = ( delta > compare ) ? delta - compare : compare - delta;
+		if( error < best_error )
+		{
+			best_error = error;
+			best_delta = delta;
+			best_dcoctl = DCOCTL;
+			best_rsel = BCSCTL1 & 0x07;
+		}
+
+		if( delta == compare )
+			break;
+
+		/* Step DCO and MOD together. When they run out, move to
+		 * the adjacent resistor, whose range overlaps this one.
+		 */
+		if( delta < compare )
+		{
+			if( DCOCTL != 0xFF )
+				DCOCTL++;
+			else if( ( BCSCTL1 & 0x07 ) != 0x07 )
+			{
+				BCSCTL1++;
+				DCOCTL = 0x00;
+			}
+			else
+				break;	/* Target above the DCO range. */
+		}
+		else
+		{
+			if( DCOCTL != 0x00 )
+				DCOCTL--;
+			else if( ( BCSCTL1 & 0x07 ) != 0x00 )
+			{
+				BCSCTL1--;
+				DCOCTL = 0xFF;
+			}
+			else
+				break;	/* Target below the DCO range. */
+		}
+	}
+
+	/* Keep the closest setting found, or the previous one if ACLK
+	 * stopped, as the measurements cannot be trusted. */
+	if( delta )
+	{
+		clock_setDCOCode( ( best_rsel << 8 ) | best_dcoctl );
+		clock_DCOFreqHz = ( ( uint32_t )best_delta * clock_ACLKFreqHz ) / CLOCK_DCO_CAL_ACLK_CYCLES;
+	}
+	else
+		clock_setDCOCode( ( rsel << 8 ) | dcoctl );
+
+	TACTL = tactl;
+	TACCTL2 = tacctl2;
+	BCSCTL2 = bcsctl2;
+
+	clock_update( );
+
+	critical_exit( state );
+
+	return delta ? clock_DCOFreqHz : 0;
+}
+
+uint32_t clock_get( clock_t clk )
+{
+	switch( clk )
+	{
+	case ACLK:
+		return clock_ACLKFreqHz;
+	case MCLK:
+		return clock_MCLKFreqHz;
+	case SMCLK:
+		return clock_SMCLKFreqHz;
+	default:
+		return 0;
+	}
+}
+
+uint16_t clock_getVersion( void )
+{
+	return clock_version;
+}
+
+void clock_subscribe( clock_listener_t* listener )
+{
+	clock_listener_t* it = clock_listeners;
+
+	for( ; it ; it = it->next )
+	{
+		if( it == listener )
+			return;
+	}
+
+	listener->next = clock_listeners;
+	clock_listeners = listener;
+}
+
+void clock_unsubscribe( clock_listener_t* listener )
+{
+	clock_listener_t** it = &clock_listeners;
+
+	for( ; *it ; it = &( *it )->next )
+	{
+		if( *it == listener )
+		{
+			*it = listener->next;
+			listener->next = NULL;
+			return;
+		}
+	}
+}
+
+/**
+ * Records a clock source change. Changes to the DCO are applied
+ * at once, changes to a crystal once it is stable.
+ */
+static void clock_pend( clock_t clk, clock_source_t source, uint8_t divider )
+{
+	if( source == DCO )
+	{
+		if( clk == MCLK )
+			clock_configMCLK( source, divider );
+		else
+			clock_configSMCLK( source, divider );
+
+		clock_pending &= ~clk;
+		if( !clock_pending )
+			clock_crystalStatus = CLOCK_CRYSTAL_STABLE;
+		return;
+	}
+
+	if( clk == MCLK )
+	{
+		clock_pendingMCLK.source = source;
+		clock_pendingMCLK.divider = divider;
+	}
+	else
+	{
+		clock_pendingSMCLK.source = source;
+		clock_pendingSMCLK.divider = divider;
+	}
+
+	/* Start the oscillator. */
+	if( source == XT2 )
+		BCSCTL1 &= ~XT2OFF;
+
+	clock_pending |= clk;
+	clock_pollStart = timer_millis( );
+	clock_crystalStatus = CLOCK_CRYSTAL_PENDING;
+}
+
+/**
+ * Notifies the listeners that the clock registers are about to change.
+ * Followed by clock_update( ).
+ */
+static void clock_prepare( void )
+{
+	clock_listener_t* it;
+
+	for( it = clock_listeners ; it ; it = it->next )
+	{
+		if( it->prepare )
+			it->prepare( it->user );
+	}
+}
+
+/**
+ * Decodes the clock frequencies from the registers into the
+ * snapshot, and notifies the listeners.
+ */
+static void clock_update( void )
+{
+	clock_listener_t* it;
+
+	clock_ACLKFreqHz = clock_getACLK( );
+	clock_MCLKFreqHz = clock_getMCLK( );
+	clock_SMCLKFreqHz = clock_getSMCLK( );
+	clock_version++;
+
+	for( it = clock_listeners ; it ; it = it->next )
+	{
+		if( it->callback )
+			it->callback( it->user );
+	}
+}
+
+/**
+ * Sets the DCO to one of the pre-defined frequencies.
+ */
+static void clock_configDCO( uint32_t dco_freq )
+{
+	uint16_t code;
+
 	switch( dco_freq )
 	{
 	/* Turn off DCOCLK */
 	case DCO_OFF:
 		__bis_SR_register( SCG0 );
-		break;
+		clock_DCOFreqHz = DCO_OFF;
+		return;
 
 	/* 750 KHz */
 	default:
+		dco_freq = DCO_FREQ_750KHz;
+		/* fall through */
 	case DCO_FREQ_750KHz:
-		DCOCTL   = ( ( 0x3 << 5 ) & 0xE0 );
-		DCOCTL  |= ( 0x00 & 0x1F );
-		BCSCTL1 |= ( 0x04 & 0x07 );
+		code = ( 0x04 << 8 ) | ( 0x3 << 5 );
 		break;
 
 	/* 1.3 MHz */
 	case DCO_FREQ_1300KHz:
-		DCOCTL   = ( ( 0x3 << 5 ) & 0xE0 );
-		DCOCTL  |= ( 0x00 & 0x1F );
-		BCSCTL1 |= ( 0x05 & 0x07 );
+		code = ( 0x05 << 8 ) | ( 0x3 << 5 );
 		break;
 
 	/* 2 MHz */
 	case DCO_FREQ_2000KHz:
-		DCOCTL   = ( ( 0x3 << 5 ) & 0xE0 );
-		DCOCTL  |= ( 0x00 & 0x1F );
-		BCSCTL1 |= ( 0x06 & 0x07 );
+		code = ( 0x06 << 8 ) | ( 0x3 << 5 );
 		break;
 
 	/* 3.2 MHz */
 	case DCO_FREQ_3200KHz:
-		DCOCTL   = ( ( 0x3 << 5 ) & 0xE0 );
-		DCOCTL  |= ( 0x00 & 0x1F );
-		BCSCTL1 |= ( 0x07 & 0x07 );
+		code = ( 0x07 << 8 ) | ( 0x3 << 5 );
 		break;
 
 	/* 4.9 MHz */
 	case DCO_FREQ_4900KHz:
-		DCOCTL   = ( ( 0x7 << 5 ) & 0xE0 );
-		DCOCTL  |= ( 0x00 & 0x1F );
-		BCSCTL1 |= ( 0x07 & 0x07 );
+		code = ( 0x07 << 8 ) | ( 0x7 << 5 );
 		break;
 	}
+
+	/* RSEL, then DCO and MOD, each in one write: the DCO passes through
+	 * no setting slower than the old and the new one, which would
+	 * stretch the time of the clocks running from it. */
+	clock_setDCOCode( code );
+
+	/* Make sure the DCO is running. */
+	__bic_SR_register( SCG0 );
+	clock_DCOFreqHz = dco_freq;
 }
 
-void clock_set( clock_t clk, clock_source_t source, uint8_t divider )
+/**
+ * Clears the oscillator fault flag and gives it time to be set again,
+ * if a crystal is still not stable.
+ * @return	Non-zero if a crystal is not stable.
+ */
+static int clock_crystalFault( void )
 {
-	switch( clk )
-	{
-	case ACLK:
-		clock_configACLK( divider );
-		break;
+	int i;
 
-	case MCLK:
-		clock_configMCLK( source, divider );
-		break;
+	IFG1 &= ~OFIFG;
+	for( i = 0xff; i > 0; i-- )
+		__nop( );
 
-	case SMCLK:
-		clock_configSMCLK( source, divider );
-		break;
+	return ( IFG1 & OFIFG ) != 0;
+}
 
-	default:
-		break;
+/**
+ * Returns the number of SMCLK periods in CLOCK_DCO_CAL_ACLK_CYCLES
+ * ACLK periods, captured with TimerA CCR2, or 0 if ACLK stopped.
+ */
+static uint16_t clock_measureDCO( void )
+{
+	uint16_t start;
+	int i;
+
+	/* Synchronize to an ACLK edge. */
+	if( !clock_waitACLK( ) )
+		return 0;
+	start = TACCR2;
+
+	for( i = 0; i < CLOCK_DCO_CAL_ACLK_CYCLES; i++ )
+	{
+		if( !clock_waitACLK( ) )
+			return 0;
 	}
 
-	WAIT_CRYSTAL( );
+	return TACCR2 - start;
 }
 
-uint32_t clock_get( clock_t clk )
+/**
+ * Waits for the next ACLK edge, captured by TimerA.
+ * @return	0 if there was none within @ref CLOCK_DCO_CAL_TIMEOUT polls.
+ */
+static int clock_waitACLK( void )
 {
-	switch( clk )
+	uint16_t i;
+
+	TACCTL2 &= ~CCIFG;
+	for( i = CLOCK_DCO_CAL_TIMEOUT; i > 0; i-- )
 	{
-	case ACLK:
-		return clock_getACLK( );
-	case MCLK:
-		return clock_getMCLK( );
-	case SMCLK:
-		return clock_getSMCLK( );
-	default:
-		return 0;
+		if( TACCTL2 & CCIFG )
+			return 1;
 	}
+
+	return 0;
+}
+
+/**
+ * Sets RSEL, DCO and MOD from an 11 bit code: RSEL in bits 10-8,
+ * DCOCTL in bits 7-0.
+ */
+static void clock_setDCOCode( uint16_t code )
+{
+	BCSCTL1 = ( BCSCTL1 & ~( RSEL0 | RSEL1 | RSEL2 ) ) | ( code >> 8 );
+	DCOCTL = code & 0xFF;
 }
 
 static void clock_configACLK( uint8_t divider )
@@ -254,3 +665,27 @@ static uint32_t clock_getSMCLK( void )
 	return freq;
 }
 
+__attribute__( ( __interrupt__( NMI_VECTOR ) ) )
+void clock_NMI_IRQ( void )
+{
+	if( IFG1 & OFIFG )
+	{
+		/* A crystal failed. MCLK is already clocked from the DCO by
+		 * the hardware; select the DCO for MCLK and SMCLK, so that
+		 * the frequencies reported stay correct. OFIE was cleared
+		 * when this interrupt was accepted; the flag must be cleared
+		 * by software, or enabling OFIE again would re-enter at once.
+		 * The listeners are prepared and notified here, as the clock
+		 * has already changed: the sooner they are retimed, the fewer
+		 * characters are sent at a wrong rate. They are prepared once
+		 * SMCLK runs again, or they would wait for a stopped USART.
+		 * Their wait is bounded, see clock.h.
+		 */
+		BCSCTL2 &= ~( SELM_3 | SELS );
+		IFG1 &= ~OFIFG;
+		clock_pending = 0;
+		clock_crystalStatus = CLOCK_CRYSTAL_FAULT;
+		clock_prepare( );
+		clock_update( );
+	}
+}
@@ -10,7 +10,8 @@
  * DCO pre-defined frequencies
  * @attention	The frequencies are for 3V3 operation and may vary
  * depending on room temperature and internal DCO resistance of the
- * specific device.
+ * specific device. Use @ref clock_calibrateDCO( ) for an accurate
+ * frequency.
  */
 #define DCO_OFF				0			/**< DCO not used. */
 #define DCO_FREQ_750KHz		750000		/**< 750 KHz. */
@@ -19,6 +20,24 @@
 #define DCO_FREQ_3200KHz	3200000		/**< 1.3 MHz. */
 #define DCO_FREQ_4900KHz	4900000		/**< 4.9 MHz. */
 
+/**
+ * Interval in which @ref clock_poll( ) is expected to be called while
+ * a crystal is starting, in msec. The timeout does not depend on it.
+ */
+#ifndef CLOCK_CRYSTAL_POLL_MSEC
+#define CLOCK_CRYSTAL_POLL_MSEC		10
+#endif
+
+/** Time a crystal is given to stabilize, in msec of @ref timer_millis( ). */
+#ifndef CLOCK_CRYSTAL_TIMEOUT_MSEC
+#define CLOCK_CRYSTAL_TIMEOUT_MSEC	1000
+#endif
+
+/** Crystal status, see @ref clock_getCrystalStatus( ). */
+#define CLOCK_CRYSTAL_STABLE	0	/**< No crystal is starting. Requested clock sources are in use. */
+#define CLOCK_CRYSTAL_PENDING	1	/**< A crystal is starting. MCLK/SMCLK run from their previous source. */
+#define CLOCK_CRYSTAL_FAULT		2	/**< A crystal did not start in time: MCLK/SMCLK stay on their previous source. Or a crystal in use failed: the NMI moved MCLK/SMCLK to the DCO. */
+
 /** Clock Source */
 typedef enum
 {
@@ -35,6 +54,21 @@ typedef enum
 	SMCLK	= 0x02		/**< Sub-main Clock. Can be clocked from XT1, XT2 or DCO. */
 } clock_t;
 
+/**
+ * Clock change listener. Peripherals that derive their timing from
+ * a clock subscribe with @ref clock_subscribe( ) and recompute their
+ * dividers when notified.
+ */
+typedef struct _clock_listener
+{
+	void ( *callback )( void* );	/**< Called after the clock frequencies have changed. */
+	void ( *prepare )( void* );		/**< Called before the clock registers change, with interrupts as the caller left them, e.g. to let a transfer in progress complete. Can be NULL. */
+	void* user;						/**< A user provided variable that is passed in the callback functions. */
+
+	// private - do not use.
+	struct _clock_listener* next;
+} clock_listener_t;
+
 /**
  * Initialises the clock module.
  * @param[in] xt1_freq	Frequency of XT1 Crystal Oscillator, in Hz.
@@ -49,14 +83,98 @@ void clock_init( uint32_t xt1_freq, uint32_t xt2_freq, uint32_t dco_freq );
  * @param[in] source	The source of the clock, one of XT1, XT2, DCO.
  * @param[in] divider	The clock source divider, one of 1, 2, 4, 8.
  * @attention ACLK only supports XT1 clock source.
+ * @note Does not wait for a crystal to stabilize. MCLK or SMCLK keep
+ * their previous source until @ref clock_poll( ) finds the crystal
+ * stable, and stay on it if the crystal does not stabilize within
+ * @ref CLOCK_CRYSTAL_TIMEOUT_MSEC.
  */
 void clock_set( clock_t clk, clock_source_t source, uint8_t divider );
 
 /**
- * Returns the frequency of the specified clock.
+ * Completes the clock source changes that wait for a crystal. Does
+ * not block: call it every @ref CLOCK_CRYSTAL_POLL_MSEC, e.g. from a
+ * periodic timer or the main loop, until it no longer returns
+ * @ref CLOCK_CRYSTAL_PENDING.
+ * @return	The crystal status, see @ref clock_getCrystalStatus( ).
+ * @attention The timeout is measured with @ref timer_millis( ), so the
+ * timer must be running, see @ref timer_init( ).
+ * @note Once the switch is made, a failure of the crystal is handled
+ * by the NMI: MCLK and SMCLK move to the DCO, and the listeners are
+ * prepared and notified from the NMI, after the clock has changed.
+ * The serial ports wait there for the characters already in their
+ * USART, at most two at the rate of the DCO, e.g. 0.7 msec at 115200
+ * baud from an 8 MHz crystal failing to a 2 MHz DCO, and the other
+ * interrupts wait for the NMI. These characters are sent at a wrong
+ * rate; the following ones are not.
+ */
+int clock_poll( void );
+
+/**
+ * Returns the crystal status.
+ * @return	@ref CLOCK_CRYSTAL_STABLE, @ref CLOCK_CRYSTAL_PENDING or
+ * @ref CLOCK_CRYSTAL_FAULT.
+ */
+int clock_getCrystalStatus( void );
+
+/**
+ * Switches the performance level: sets the DCO to one of the pre-defined
+ * frequencies and clocks MCLK and SMCLK from it. The change is atomic:
+ * the subscribed peripherals are retimed before interrupts are enabled
+ * again, so baudrates and @ref timer_millis( ) are preserved. The change
+ * is held until the serial ports and SPI have shifted out the characters
+ * being transmitted, see @ref clock_listener_t. Reception is not held:
+ * a character received while the dividers are reprogrammed may be lost.
+ * A switch to a crystal still pending in @ref clock_poll( ) is cancelled.
+ * @param[in] dco_freq		DCO frequency. One of DCO_FREQ_XXX.
+ * @param[in] mclk_divider	MCLK divider. One of 1, 2, 4, 8.
+ * @param[in] smclk_divider	SMCLK divider. One of 1, 2, 4, 8.
+ */
+void clock_setPerformanceLevel( uint32_t dco_freq, uint8_t mclk_divider, uint8_t smclk_divider );
+
+/**
+ * Tunes the DCO to the target frequency, using the ACLK crystal as
+ * reference, and makes the measured frequency the DCO frequency
+ * returned by @ref clock_get( ). The DCO, MOD and RSEL settings are
+ * stepped until the DCO matches the target, or the closest setting
+ * within a bounded number of steps is kept.
+ * @param[in] target	Target DCO frequency in Hz.
+ * @return	Measured DCO frequency in Hz, or 0 if ACLK is not running or
+ * stopped during the calibration, in which case the DCO settings are
+ * left unchanged.
+ * @attention Uses TimerA, so it must be called before @ref timer_init( ).
+ * ACLK must be clocked from a 32 kHz crystal that has stabilized.
+ * Interrupts are disabled during the calibration.
+ */
+uint32_t clock_calibrateDCO( uint32_t target );
+
+/**
+ * Returns the frequency of the specified clock. The frequencies are
+ * cached when the clocks are configured, so this is inexpensive.
  * @param[in] clock 	One of ACLK, MCLK, SMCLK.
  * @return	Frequency in Hz.
  */
 uint32_t clock_get( clock_t clk );
 
+/**
+ * Returns the version of the clock configuration. The version changes
+ * every time the clocks are configured, so a value derived from the
+ * clock frequencies is stale if its version differs.
+ * @return	Clock configuration version.
+ */
+uint16_t clock_getVersion( void );
+
+/**
+ * Subscribes to clock changes. The listener's callback is called
+ * after every change of the clock configuration. Subscribing a
+ * listener more than once has no effect.
+ * @param[in] listener	The listener. Must not be destroyed while subscribed.
+ */
+void clock_subscribe( clock_listener_t* listener );
+
+/**
+ * Unsubscribes from clock changes.
+ * @param[in] listener	The listener.
+ */
+void clock_unsubscribe( clock_listener_t* listener );
+
 #endif
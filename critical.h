@@ -0,0 +1,43 @@
+/**
+ * @Brief Critical section helpers.
+ *
+ * Data shared between an interrupt handler and the main program
+ * must be updated with interrupts disabled. @ref critical_enter( )
+ * disables interrupts and returns the previous interrupt state,
+ * which is restored by @ref critical_exit( ). Critical sections
+ * may therefore be nested, or used from within interrupt handlers.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef CRITICAL_H_
+#define CRITICAL_H_
+
+#include "types.h"
+#include <msp430.h>
+
+/** Saved interrupt state. */
+typedef uint16_t critical_state_t;
+
+/**
+ * Disables interrupts.
+ * @return	The interrupt state before the call.
+ */
+static inline critical_state_t critical_enter( void )
+{
+	critical_state_t state = __get_SR_register( ) & GIE;
+	__disable_interrupt( );
+	return state;
+}
+
+/**
+ * Restores the interrupt state saved by @ref critical_enter( ).
+ * @param[in] state		The interrupt state to restore.
+ */
+static inline void critical_exit( critical_state_t state )
+{
+	if( state )
+		__enable_interrupt( );
+}
+
+#endif
@@ -1,6 +1,20 @@
 #include "delay.h"
 #include "timer.h"
 #include "types.h"
+#include "clock.h"
+#include "critical.h"
+#include "instrument.h"
+
+#include <msp430.h>
+
+/** MCLK cycles per iteration of @ref delay_loop( ). */
+#define DELAY_LOOP_CYCLES		4
+
+static uint32_t _delay_mclk;
+static uint16_t _delay_cycles_per_usec;	/* 8.8 fixed point */
+
+static void delay_loop( uint16_t iterations );
+static void delay_wakeup( void* user );
 
 unsigned long millis( void )
 {
@@ -8,6 +22,11 @@ unsigned long millis( void )
 	return timer_millis( );
 }
 
+unsigned long micros( void )
+{
+	return timer_micros( );
+}
+
 unsigned long elapsed_millis( unsigned long start )
 {
 	unsigned long current = millis( );
@@ -26,3 +45,93 @@ void delay( unsigned long msec )
 	unsigned long start = millis();
 	while( elapsed_millis( start ) < msec );
 }
+
+void delay_sleep( unsigned long msec )
+{
+	timer_t timer = { 0 };
+	volatile uint8_t expired;
+	uint16_t lpm_bits = ( timer_getClockSource( ) == SMCLK ) ? LPM0_bits : LPM3_bits;
+
+	timer.mode = TIMER_MODE_ONESHOT | TIMER_MODE_WAKEUP;
+	timer.callback = delay_wakeup;
+	timer.user = ( void* )&expired;
+
+	while( msec >= TIMER_RESOLUTION_MSEC )
+	{
+		unsigned long chunk = msec;
+		if( chunk > DELAY_SLEEP_MAX_MSEC )
+			chunk = DELAY_SLEEP_MAX_MSEC;
+		chunk -= chunk % TIMER_RESOLUTION_MSEC;
+
+		expired = 0;
+		timer.period_msec = chunk;
+		timer_start( &timer );
+
+		critical_state_t state = critical_enter( );
+		while( !expired )
+		{
+			/* Enabling interrupts and entering LPM in the same
+			 * instruction cannot miss the timer's wake-up. */
+			INSTRUMENT_SLEEP_ENTER( );
+			__bis_SR_register( lpm_bits | GIE );
+			__disable_interrupt( );
+			INSTRUMENT_SLEEP_EXIT( );
+		}
+		critical_exit( state );
+
+		msec -= chunk;
+	}
+
+	/* Sub-tick remainder. */
+	if( msec )
+		delay_us( msec * 1000 );
+}
+
+void delay_us( unsigned int usec )
+{
+	if( usec > DELAY_US_POLL_THRESHOLD )
+	{
+		unsigned long start = micros( );
+		while( micros( ) - start < usec );
+		return;
+	}
+
+	/* Recalculate the loop rate only when MCLK changes. */
+	uint32_t mclk = clock_get( MCLK );
+	if( mclk != _delay_mclk )
+	{
+		_delay_mclk = mclk;
+		_delay_cycles_per_usec = ( mclk << 8 ) / 1000000UL;
+	}
+
+	uint32_t cycles = ( ( uint32_t )usec * _delay_cycles_per_usec ) >> 8;
+	if( cycles <= DELAY_US_OVERHEAD_CYCLES )
+		return;
+
+	/* Below the poll threshold the iteration count fits 16 bits. */
+	uint16_t iterations = ( cycles - DELAY_US_OVERHEAD_CYCLES ) / DELAY_LOOP_CYCLES;
+	if( iterations )
+		delay_loop( iterations );
+}
+
+static void delay_loop( uint16_t iterations )
+{
+#ifdef __MSP430__
+	/* DELAY_LOOP_CYCLES per iteration: nop (1), dec (1), jnz (2). */
+	__asm__ __volatile__
+	(
+		"1:	nop			\n"
+		"	dec	%0		\n"
+		"	jnz	1b		\n"
+		: "+r"( iterations )
+	);
+#else
+	/* Host build: the simulator runs the cycles of the loop. */
+	__delay_cycles( ( uint32_t )iterations * DELAY_LOOP_CYCLES );
+#endif
+}
+
+static void delay_wakeup( void* user )
+{
+	*( volatile uint8_t* )user = 1;
+}
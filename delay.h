@@ -5,12 +5,27 @@
 extern "C" {
 #endif
 
+/** MCLK cycles spent in @ref delay_us( ) outside of the delay loop. */
+#define DELAY_US_OVERHEAD_CYCLES	60
+
+/** Longest single sleep in @ref delay_sleep( ), must fit the timer period. */
+#define DELAY_SLEEP_MAX_MSEC		30000
+
+/** Delays above this many usecs poll @ref micros( ) instead of counting cycles. */
+#define DELAY_US_POLL_THRESHOLD		( 2000 )
+
 /**
  * Returns the number of milliseconds since power-up.
  * @return		Milliseconds count.
  */
 unsigned long millis( void );
 
+/**
+ * Returns the number of microseconds since power-up.
+ * @return		Microseconds count.
+ */
+unsigned long micros( void );
+
 /**
  * Calculates the elapsed number of milliseconds since
  * @ref start. This funtion will account for any overflow
@@ -26,6 +41,29 @@ unsigned long elapsed_millis( unsigned long start );
  */
 void delay( unsigned long msec );
 
+/**
+ * Delays for the specified number of milliseconds in low power mode.
+ * The CPU sleeps in LPM3, or in LPM0 if the hardware timer is clocked
+ * from SMCLK, and is woken up by a one-shot software timer. Intervals
+ * shorter than @ref TIMER_RESOLUTION_MSEC are busy-waited.
+ * @param[in]	msec	Number of msecs to delay.
+ * @attention Interrupts must be enabled. Other interrupts that wake
+ * the CPU do not end the delay early.
+ */
+void delay_sleep( unsigned long msec );
+
+/**
+ * Delays for the specified number of microseconds.
+ * Short delays are counted in MCLK cycles at the current
+ * @ref clock_get( MCLK ) frequency, accounting for the call
+ * overhead. Longer delays poll @ref micros( ).
+ * @param[in]	usec	Number of usecs to delay.
+ * @attention Delays shorter than the call overhead, about
+ * @ref DELAY_US_OVERHEAD_CYCLES MCLK cycles, return immediately.
+ * Interrupts serviced during a short delay extend it.
+ */
+void delay_us( unsigned int usec );
+
 #ifdef __cplusplus
 }
 #endif
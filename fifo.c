@@ -1,33 +1,120 @@
 #include "fifo.h"
 #include "types.h"
 
-void Fifo_init( Fifo_t* fifo )
+#include <string.h>
+
+/* Keeps the compiler from moving buffer accesses across
+ * the update of a position, which publishes them. */
+#define FIFO_BARRIER( )		__asm__ __volatile__( "" ::: "memory" )
+
+void Fifo_init( Fifo_t* fifo, uint8_t* buffer, uint16_t size )
 {
+	fifo->buffer = buffer;
+	fifo->mask = size - 1;
 	fifo->rpos = 0;
 	fifo->wpos = 0;
+	fifo->dropped = 0;
+	fifo->peak = 0;
+}
+
+void Fifo_flush( Fifo_t* fifo )
+{
+	fifo->rpos = fifo->wpos;
 }
 
-void Fifo_push( Fifo_t* fifo, uint8_t byte )
+int Fifo_push( Fifo_t* fifo, uint8_t byte )
 {
-	 if( ( fifo->wpos + 1 ) % FIFO_BUFFER_SIZE == fifo->rpos )
-		 return;
+	uint16_t wpos = fifo->wpos;
+	uint16_t size = wpos - fifo->rpos;
+
+	if( size > fifo->mask )
+	{
+		fifo->dropped++;
+		return 0;
+	}
+
+	fifo->buffer[wpos & fifo->mask] = byte;
+	FIFO_BARRIER( );
+	fifo->wpos = wpos + 1;
+
+	if( size >= fifo->peak )
+		fifo->peak = size + 1;
 
-	 fifo->buffer[fifo->wpos] = byte;
-	 fifo->wpos = ( fifo->wpos + 1 ) % FIFO_BUFFER_SIZE;
+	return 1;
 }
 
 uint8_t Fifo_pop( Fifo_t* fifo )
 {
-	if( fifo->rpos == fifo->wpos )
-		return EOF;
+	uint8_t ch;
 
-	char ch = fifo->buffer[fifo->rpos];
-	fifo->rpos = ( fifo->rpos + 1 ) % FIFO_BUFFER_SIZE;
+	if( !Fifo_get( fifo, &ch ) )
+		return EOF;
 
 	return ch;
 }
 
+int Fifo_get( Fifo_t* fifo, uint8_t* byte )
+{
+	uint16_t rpos = fifo->rpos;
+
+	if( rpos == fifo->wpos )
+		return 0;
+
+	FIFO_BARRIER( );
+	*byte = fifo->buffer[rpos & fifo->mask];
+	FIFO_BARRIER( );
+	fifo->rpos = rpos + 1;
+
+	return 1;
+}
+
+uint16_t Fifo_read( Fifo_t* fifo, uint8_t* dst, uint16_t max )
+{
+	uint16_t count = 0;
+
+	/* At most two spans: up to the end of the buffer, then from its start. */
+	while( count < max )
+	{
+		const uint8_t* span;
+		uint16_t n = Fifo_peekSpan( fifo, &span );
+		if( n == 0 )
+			break;
+
+		if( n > max - count )
+			n = max - count;
+
+		memcpy( dst + count, span, n );
+		Fifo_commit( fifo, n );
+		count += n;
+	}
+
+	return count;
+}
+
+uint16_t Fifo_peekSpan( Fifo_t* fifo, const uint8_t** span )
+{
+	/* wpos may be advanced by the producer; sample it once. */
+	uint16_t rpos = fifo->rpos;
+	uint16_t count = fifo->wpos - rpos;
+	uint16_t index = rpos & fifo->mask;
+
+	/* Stop at the end of the buffer. */
+	if( count > fifo->mask + 1 - index )
+		count = fifo->mask + 1 - index;
+
+	FIFO_BARRIER( );
+	*span = &fifo->buffer[index];
+
+	return count;
+}
+
+void Fifo_commit( Fifo_t* fifo, uint16_t count )
+{
+	FIFO_BARRIER( );
+	fifo->rpos += count;
+}
+
 uint16_t Fifo_size( Fifo_t* fifo )
 {
-	return ( fifo->wpos + FIFO_BUFFER_SIZE - fifo->rpos ) % FIFO_BUFFER_SIZE;
+	return fifo->wpos - fifo->rpos;
 }
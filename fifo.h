@@ -1,3 +1,21 @@
+/**
+ * @Brief Implements a byte FIFO (ring buffer).
+ *
+ * The FIFO size must be a power of two, so that the read and write
+ * positions wrap with a mask instead of a division. The positions run
+ * freely and all of size bytes can be stored.
+ *
+ * The FIFO is lock-free for a single producer and a single consumer,
+ * typically an interrupt handler and the main program. Only the producer
+ * calls @ref Fifo_push( ), and only the consumer calls the functions that
+ * read or remove bytes. Each position is written by one side only.
+ *
+ * In C, define a FIFO with @ref FIFO_DEFINE( ). In C++, use the
+ * Fifo< N > template.
+ *
+ * @Author iliaspat
+ *
+ */
 #ifndef FIFO_H_
 #define FIFO_H_
 
@@ -7,56 +25,138 @@
 extern "C" {
 #endif
 
-/** Number of bytes that can be stored in the FIFO */
-#define FIFO_BUFFER_SIZE	128
+/** Returns 1 if size is a valid FIFO size: a power of two, at least 2. */
+#define FIFO_SIZE_VALID( size )		( ( size ) >= 2 && ( ( ( size ) & ( ( size ) - 1 ) ) == 0 ) )
+
+/**
+ * Defines a static FIFO and its storage. Fails to compile if
+ * size is not valid.
+ * @param[in] name		Name of the FIFO structure.
+ * @param[in] size		Number of bytes that can be stored in the FIFO.
+ */
+#define FIFO_DEFINE( name, size )												\
+	_Static_assert( FIFO_SIZE_VALID( size ), "FIFO size must be a power of two" );	\
+	static uint8_t name##_buffer[size];										\
+	static Fifo_t name = { name##_buffer, ( size ) - 1, 0, 0, 0, 0 }
 
 /**
  * FIFO structure.
  */
 typedef struct
 {
-	uint8_t buffer[FIFO_BUFFER_SIZE];
-	volatile uint16_t wpos;
-	volatile uint16_t rpos;
+	uint8_t* buffer;
+	uint16_t mask;				/**< Size of buffer minus 1. */
+	volatile uint16_t wpos;		/**< Written by the producer only. */
+	volatile uint16_t rpos;		/**< Written by the consumer only. */
+	volatile uint16_t dropped;	/**< Number of bytes dropped because the FIFO was full. */
+	volatile uint16_t peak;		/**< Highest number of bytes stored at once. */
 } Fifo_t;
 
 /**
  * Initialise the FIFO.
  * @param[in] fifo		The FIFO structure.
+ * @param[in] buffer	Storage for the FIFO.
+ * @param[in] size		Size of buffer. Must be a power of two.
+ */
+void Fifo_init( Fifo_t* fifo, uint8_t* buffer, uint16_t size );
+
+/**
+ * Discards all bytes stored in the FIFO.
+ * Called by the consumer.
+ * @param[in] fifo		The FIFO structure.
  */
-void Fifo_init( Fifo_t* fifo );
+void Fifo_flush( Fifo_t* fifo );
 
 /**
- * Write a byte at the end of the FIFO.
+ * Write a byte at the end of the FIFO. If the FIFO is full, the byte
+ * is dropped and counted in the dropped statistic.
  * @param[in] fifo		The FIFO structure.
  * @param[in] byte		Byte to write.
+ * @return				1 if the byte was written, 0 if the FIFO is full.
  */
-void Fifo_push( Fifo_t* fifo, uint8_t byte );
+int Fifo_push( Fifo_t* fifo, uint8_t byte );
 
 /**
  * Read a byte from the start of the FIFO.
  * @param[in] fifo		The FIFO structure.
  * @return				Byte
+ * @attention Returns EOF truncated to a byte if the FIFO is empty, which
+ * cannot be told apart from data. Use @ref Fifo_get( ) instead.
  */
 uint8_t Fifo_pop( Fifo_t* fifo );
 
+/**
+ * Read a byte from the start of the FIFO.
+ * @param[in] fifo		The FIFO structure.
+ * @param[out] byte		Stores the byte read.
+ * @return				1 if a byte was read, 0 if the FIFO is empty.
+ */
+int Fifo_get( Fifo_t* fifo, uint8_t* byte );
+
+/**
+ * Read up to max bytes from the start of the FIFO.
+ * @param[in] fifo		The FIFO structure.
+ * @param[out] dst		Stores the bytes read.
+ * @param[in] max		Maximum number of bytes to read.
+ * @return				Number of bytes read.
+ */
+uint16_t Fifo_read( Fifo_t* fifo, uint8_t* dst, uint16_t max );
+
+/**
+ * Returns the bytes at the start of the FIFO that are contiguous
+ * in the FIFO buffer, without removing them. The bytes can be
+ * parsed in place and then removed with @ref Fifo_commit( ).
+ * A second call after the commit returns the rest of the bytes,
+ * if the stored bytes wrap around the end of the buffer.
+ * @param[in] fifo		The FIFO structure.
+ * @param[out] span		Set to the first byte of the span.
+ * @return				Number of bytes in the span.
+ */
+uint16_t Fifo_peekSpan( Fifo_t* fifo, const uint8_t** span );
+
+/**
+ * Removes bytes from the start of the FIFO.
+ * @param[in] fifo		The FIFO structure.
+ * @param[in] count		Number of bytes to remove. Must not exceed
+ * 						the size of the span returned by @ref Fifo_peekSpan( ).
+ */
+void Fifo_commit( Fifo_t* fifo, uint16_t count );
+
 /**
  * Returns the number of bytes currently stored in the FIFO.
  * @return				FIFO size in bytes.
  */
 uint16_t Fifo_size( Fifo_t* fifo );
 
+/** Returns the number of bytes that can be stored in the FIFO. */
+#define Fifo_capacity( fifo )	( ( uint16_t )( ( fifo )->mask + 1 ) )
+
 /** Returns 1 if FIFO empty, 0 otherwise. */
-#define Fifo_empty( fifo )		( Fifo_size( ( fifo ) ) != 0 )
+#define Fifo_empty( fifo )		( Fifo_size( ( fifo ) ) == 0 )
 
 /** Returns 1 if FIFO full, 0 otherwise. */
-#define Fifo_full( fifo )		( Fifo_size( ( fifo ) ) != 128 )
+#define Fifo_full( fifo )		( Fifo_size( ( fifo ) ) == Fifo_capacity( ( fifo ) ) )
 
 /** Returns the number of bytes available in the FIFO. */
 #define Fifo_available( fifo )	( Fifo_size( ( fifo ) ) )
 
 #ifdef __cplusplus
 }
+
+/**
+ * FIFO with storage for N bytes. N must be a power of two.
+ * Can be passed to all Fifo_ functions.
+ */
+template< uint16_t N >
+struct Fifo : Fifo_t
+{
+	static_assert( FIFO_SIZE_VALID( N ), "FIFO size must be a power of two" );
+
+	Fifo( ) { Fifo_init( this, storage, N ); }
+
+private:
+	uint8_t storage[N];
+};
 #endif
 
 #endif
@@ -1,7 +1,30 @@
 #include "gpio.h"
 #include "types.h"
+#include "critical.h"
+#include "instrument.h"
 
 #include <msp430.h>
+#include <signal.h>
+
+/** Number of ports: P1 to P6. */
+#define GPIO_NUM_PORTS			6
+
+/** Number of ports with interrupt capability: P1 and P2. */
+#define GPIO_NUM_IRQ_PORTS		2
+
+/** Returns 1 if port is one of P1 to P6. */
+#define GPIO_isValidPort( port )	( ( port ) >= 1 && ( port ) <= GPIO_NUM_PORTS )
+
+/** Returns the index of the lowest set bit of an 8 bit value, see GPIO_lowestBit( ). */
+static const uint8_t GPIO_bitIndex[8] = { 0, 1, 6, 2, 7, 5, 4, 3 };
+
+static void ( *GPIO_callbacks[GPIO_NUM_IRQ_PORTS][8] )( unsigned int );
+static uint8_t GPIO_wakeupMask[GPIO_NUM_IRQ_PORTS];
+static uint8_t GPIO_levelMask[GPIO_NUM_IRQ_PORTS];
+
+static void GPIO_arm( int port, uint8_t mask );
+static inline uint8_t GPIO_lowestBit( uint8_t flags );
+static inline int GPIO_irqHandler( int port );
 
 const volatile struct
 {
@@ -9,18 +32,47 @@ const volatile struct
 	volatile unsigned char* POUT;
 	volatile unsigned char* PDIR;
 	volatile unsigned char* PSEL;
+#ifdef P1REN
+	volatile unsigned char* PREN;
+#endif
 } GPIO_portTable[] =
 {
+#ifdef P1REN
+	{ .PIN  = &P1IN, .POUT  = &P1OUT, .PDIR = &P1DIR, .PSEL = &P1SEL, .PREN = &P1REN },
+	{ .PIN  = &P2IN, .POUT  = &P2OUT, .PDIR = &P2DIR, .PSEL = &P2SEL, .PREN = &P2REN },
+	{ .PIN  = &P3IN, .POUT  = &P3OUT, .PDIR = &P3DIR, .PSEL = &P3SEL, .PREN = &P3REN },
+	{ .PIN  = &P4IN, .POUT  = &P4OUT, .PDIR = &P4DIR, .PSEL = &P4SEL, .PREN = &P4REN },
+	{ .PIN  = &P5IN, .POUT  = &P5OUT, .PDIR = &P5DIR, .PSEL = &P5SEL, .PREN = &P5REN },
+	{ .PIN  = &P6IN, .POUT  = &P6OUT, .PDIR = &P6DIR, .PSEL = &P6SEL, .PREN = &P6REN }
+#else
 	{ .PIN  = &P1IN, .POUT  = &P1OUT, .PDIR = &P1DIR, .PSEL = &P1SEL },
 	{ .PIN  = &P2IN, .POUT  = &P2OUT, .PDIR = &P2DIR, .PSEL = &P2SEL },
 	{ .PIN  = &P3IN, .POUT  = &P3OUT, .PDIR = &P3DIR, .PSEL = &P3SEL },
 	{ .PIN  = &P4IN, .POUT  = &P4OUT, .PDIR = &P4DIR, .PSEL = &P4SEL },
 	{ .PIN  = &P5IN, .POUT  = &P5OUT, .PDIR = &P5DIR, .PSEL = &P5SEL },
 	{ .PIN  = &P6IN, .POUT  = &P6OUT, .PDIR = &P6DIR, .PSEL = &P6SEL }
+#endif
+};
+
+/**
+ * Interrupt registers of the ports with interrupt capability.
+ */
+static const struct
+{
+	volatile unsigned char* PIE;
+	volatile unsigned char* PIES;
+	volatile unsigned char* PIFG;
+} GPIO_irqTable[GPIO_NUM_IRQ_PORTS] =
+{
+	{ .PIE = &P1IE, .PIES = &P1IES, .PIFG = &P1IFG },
+	{ .PIE = &P2IE, .PIES = &P2IES, .PIFG = &P2IFG }
 };
 
 void GPIO_set( uint8_t port, uint8_t bit, uint8_t value )
 {
+	if( !GPIO_isValidPort( port ) )
+		return;
+
 	if( value )
 		*GPIO_portTable[port-1].POUT |= ( 1 << bit );
 	else
@@ -29,6 +81,9 @@ void GPIO_set( uint8_t port, uint8_t bit, uint8_t value )
 
 uint8_t GPIO_get( uint8_t port, uint8_t bit )
 {
+	if( !GPIO_isValidPort( port ) )
+		return LOW;
+
 	if( *GPIO_portTable[port-1].PIN & ( 1 << bit ) )
 		return HIGH;
 	else
@@ -37,13 +92,19 @@ uint8_t GPIO_get( uint8_t port, uint8_t bit )
 
 void GPIO_toggle( uint8_t port, uint8_t bit )
 {
+	if( !GPIO_isValidPort( port ) )
+		return;
+
 	*GPIO_portTable[port-1].POUT ^= ( 1 << bit );
 }
 
 void GPIO_mode( uint8_t port, uint8_t bit, uint8_t mode )
 {
+	if( !GPIO_isValidPort( port ) )
+		return;
+
 	/* Select GPIO function */
-	*GPIO_portTable[port-1].PSEL &= ( 1 << bit );
+	*GPIO_portTable[port-1].PSEL &= ~( 1 << bit );
 
 	if( mode == OUTPUT )
 		*GPIO_portTable[port-1].PDIR |= ( 1 << bit );
@@ -51,10 +112,171 @@ void GPIO_mode( uint8_t port, uint8_t bit, uint8_t mode )
 		*GPIO_portTable[port-1].PDIR &= ~( 1 << bit );
 }
 
-// TODO
-//void GPIO_pull( uint8_t port, uint8_t bit, uint8_t pull );
-//void GPIO_attachInterrupt( uint8_t port, uint8_t bit, void ( *callback )( unsigned int ), uint8_t mode );
-//void GPIO_detachInterrupt( uint8_t port, uint8_t bit );
+void GPIO_writePort( uint8_t port, uint8_t value )
+{
+	if( !GPIO_isValidPort( port ) )
+		return;
+
+	*GPIO_portTable[port-1].POUT = value;
+}
+
+uint8_t GPIO_readPort( uint8_t port )
+{
+	if( !GPIO_isValidPort( port ) )
+		return 0;
+
+	return *GPIO_portTable[port-1].PIN;
+}
+
+void GPIO_writeMasked( uint8_t port, uint8_t mask, uint8_t value )
+{
+	if( !GPIO_isValidPort( port ) )
+		return;
+
+	volatile unsigned char* out = GPIO_portTable[port-1].POUT;
+
+	/* An interrupt could change the other pins between the read and the write. */
+	critical_state_t state = critical_enter( );
+	*out = ( *out & ~mask ) | ( value & mask );
+	critical_exit( state );
+}
+
+void GPIO_groupInit( GPIO_group_t* group, uint8_t port, uint8_t mask, uint8_t mode )
+{
+	group->port = port;
+	group->mask = mask;
+	group->shift = 0;
+
+	/* An empty group has no lowest pin to align to. Left empty,
+	 * the group is not written and reads as 0. */
+	if( !GPIO_isValidPort( port ) || mask == 0 )
+	{
+		group->mask = 0;
+		return;
+	}
+
+	while( !( mask & ( 1 << group->shift ) ) )
+		group->shift++;
+
+	/* Select GPIO function */
+	*GPIO_portTable[port-1].PSEL &= ~mask;
+
+	if( mode == OUTPUT )
+		*GPIO_portTable[port-1].PDIR |= mask;
+	else
+		*GPIO_portTable[port-1].PDIR &= ~mask;
+}
+
+void GPIO_groupWrite( const GPIO_group_t* group, uint8_t value )
+{
+	GPIO_writeMasked( group->port, group->mask, value << group->shift );
+}
+
+uint8_t GPIO_groupRead( const GPIO_group_t* group )
+{
+	if( !GPIO_isValidPort( group->port ) )
+		return 0;
+
+	return ( *GPIO_portTable[group->port-1].PIN & group->mask ) >> group->shift;
+}
+
+void GPIO_pull( uint8_t port, uint8_t bit, uint8_t pull )
+{
+#ifdef P1REN
+	if( !GPIO_isValidPort( port ) || bit > 7 )
+		return;
+
+	if( pull == NOPULL )
+	{
+		*GPIO_portTable[port-1].PREN &= ~( 1 << bit );
+		return;
+	}
+
+	/* The output register selects pull-up or pull-down. */
+	if( pull == PULLUP )
+		*GPIO_portTable[port-1].POUT |= ( 1 << bit );
+	else
+		*GPIO_portTable[port-1].POUT &= ~( 1 << bit );
+
+	*GPIO_portTable[port-1].PREN |= ( 1 << bit );
+#else
+	/* No internal resistors on this device. */
+	( void )port;
+	( void )bit;
+	( void )pull;
+#endif
+}
+
+void GPIO_attachInterrupt( uint8_t port, uint8_t bit, void ( *callback )( unsigned int ), uint8_t mode )
+{
+	uint8_t mask = ( 1 << bit );
+
+	/* Only P1 and P2 have interrupts. */
+	if( port < 1 || port > GPIO_NUM_IRQ_PORTS || bit > 7 )
+		return;
+
+	critical_state_t state = critical_enter( );
+
+	*GPIO_irqTable[port-1].PIE &= ~mask;
+
+	GPIO_callbacks[port-1][bit] = callback;
+
+	if( mode & GPIO_WAKEUP )
+		GPIO_wakeupMask[port-1] |= mask;
+	else
+		GPIO_wakeupMask[port-1] &= ~mask;
+
+	/* Select the edge. A low level is emulated with
+	 * the falling edge, see GPIO_irqHandler( ). */
+	mode &= ~GPIO_WAKEUP;
+	if( mode == RISING )
+		*GPIO_irqTable[port-1].PIES &= ~mask;
+	else
+		*GPIO_irqTable[port-1].PIES |= mask;
+
+	if( mode == LEVEL )
+		GPIO_levelMask[port-1] |= mask;
+	else
+		GPIO_levelMask[port-1] &= ~mask;
+
+	GPIO_arm( port - 1, mask );
+
+	critical_exit( state );
+}
+
+void GPIO_rearmInterrupt( uint8_t port, uint8_t bit )
+{
+	uint8_t mask = ( 1 << bit );
+
+	if( port < 1 || port > GPIO_NUM_IRQ_PORTS || bit > 7 )
+		return;
+
+	critical_state_t state = critical_enter( );
+
+	/* Edge interrupts are never disarmed. */
+	if( GPIO_levelMask[port-1] & mask )
+		GPIO_arm( port - 1, mask );
+
+	critical_exit( state );
+}
+
+void GPIO_detachInterrupt( uint8_t port, uint8_t bit )
+{
+	uint8_t mask = ( 1 << bit );
+
+	if( port < 1 || port > GPIO_NUM_IRQ_PORTS || bit > 7 )
+		return;
+
+	critical_state_t state = critical_enter( );
+
+	*GPIO_irqTable[port-1].PIE &= ~mask;
+	*GPIO_irqTable[port-1].PIFG &= ~mask;
+	GPIO_callbacks[port-1][bit] = NULL;
+	GPIO_wakeupMask[port-1] &= ~mask;
+	GPIO_levelMask[port-1] &= ~mask;
+
+	critical_exit( state );
+}
 
 // Arduino interface
 #include "pin_map.h"
@@ -80,6 +302,99 @@ void pinMode( int pin, int mode )
 	GPIO_mode( port, bit, mode );
 }
 
-// TODO
-//void attachInterrupt( int pin, void ( *callback )( unsigned int ), int mode );
-//void detachInterrupt( int pin );
+void attachInterrupt( int pin, void ( *callback )( unsigned int ), int mode )
+{
+	uint8_t port = mapPinToPort( pin );
+	uint8_t bit  = mapPinToBit( pin );
+	GPIO_attachInterrupt( port, bit, callback, mode );
+}
+
+void detachInterrupt( int pin )
+{
+	uint8_t port = mapPinToPort( pin );
+	uint8_t bit  = mapPinToBit( pin );
+	GPIO_detachInterrupt( port, bit );
+}
+
+void rearmInterrupt( int pin )
+{
+	uint8_t port = mapPinToPort( pin );
+	uint8_t bit  = mapPinToBit( pin );
+	GPIO_rearmInterrupt( port, bit );
+}
+
+/**
+ * Enables the interrupt of the masked pins. The flag is cleared, as
+ * changing the edge may set it, and set if a low level pin is low.
+ * Called with interrupts disabled.
+ */
+static void GPIO_arm( int port, uint8_t mask )
+{
+	*GPIO_irqTable[port].PIFG &= ~mask;
+
+	if( GPIO_levelMask[port] & mask & ~*GPIO_portTable[port].PIN )
+		*GPIO_irqTable[port].PIFG |= mask;
+
+	*GPIO_irqTable[port].PIE |= mask;
+}
+
+/**
+ * Returns the index of the lowest set bit. The lowest bit is isolated
+ * and multiplied by a de Bruijn sequence, whose top 3 bits are then
+ * unique for each bit.
+ */
+static inline uint8_t GPIO_lowestBit( uint8_t flags )
+{
+	uint8_t lowest = flags & -flags;
+	return GPIO_bitIndex[( uint8_t )( lowest * 0x1D ) >> 5];
+}
+
+/**
+ * Calls the callbacks of the pins whose flags are set. Only the flagged
+ * pins are visited. Returns 1 if the CPU should be woken up.
+ */
+static inline int GPIO_irqHandler( int port )
+{
+	uint8_t flags = *GPIO_irqTable[port].PIFG & *GPIO_irqTable[port].PIE;
+	uint8_t wakeup = flags & GPIO_wakeupMask[port];
+	uint8_t bit;
+
+	/* Clear the flags first, so that edges during the callbacks are not lost.
+	 * Low level pins are disarmed until GPIO_rearmInterrupt( ): the level
+	 * stays low until the callback or the main loop serves the device. */
+	*GPIO_irqTable[port].PIFG &= ~flags;
+	*GPIO_irqTable[port].PIE &= ~( flags & GPIO_levelMask[port] );
+
+	while( flags )
+	{
+		bit = GPIO_lowestBit( flags );
+		flags &= flags - 1;
+
+		if( GPIO_callbacks[port][bit] )
+			GPIO_callbacks[port][bit]( ( ( port + 1 ) << 8 ) | bit );
+	}
+
+	return wakeup != 0;
+}
+
+__attribute__( ( __interrupt__( PORT1_VECTOR ) ) )
+void GPIO_PORT1_IRQ( void )
+{
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_PORT1 );
+	int wakeup = GPIO_irqHandler( 0 );
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_PORT1 );
+
+	if( wakeup )
+		__bic_SR_register_on_exit( LPM4_bits );
+}
+
+__attribute__( ( __interrupt__( PORT2_VECTOR ) ) )
+void GPIO_PORT2_IRQ( void )
+{
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_PORT2 );
+	int wakeup = GPIO_irqHandler( 1 );
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_PORT2 );
+
+	if( wakeup )
+		__bic_SR_register_on_exit( LPM4_bits );
+}
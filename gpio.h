@@ -2,6 +2,7 @@
 #define GPIO_H_
 
 #include "types.h"
+#include <msp430.h>
 
 /** GPIO Mode */
 #define  INPUT 		0
@@ -17,12 +18,28 @@
 #define  HIGH		1
 
 /** GPIO interrupt mode */
-#define LEVEL		0
+#define LEVEL		0		/**< Low level. Emulated: the interrupt is disabled when taken, and taken again while the pin is low once re-armed with @ref GPIO_rearmInterrupt( ). */
 #define RISING		1
 #define FALLING		2
 
 /**
- * Sets the GPIO pin direction.
+ * Group of pins of one port, written and read in a single register
+ * access. See @ref GPIO_groupInit( ).
+ */
+typedef struct
+{
+	uint8_t port;		/**< GPIO port, 1 to 6 */
+	uint8_t mask;		/**< Pins of the group. */
+
+	// private - do not use.
+	uint8_t shift;
+} GPIO_group_t;
+
+/** GPIO interrupt flag, OR'ed with the mode: the CPU is woken up from low power mode on interrupt. */
+#define GPIO_WAKEUP	0x80
+
+/**
+ * Sets the GPIO pin direction. Ignored if the port is invalid.
  * @param[in] port		GPIO port, 1 to 6
  * @param[in] bit		GPIO port bit, 0 to 7
  * @param[in] mode		@ref INPUT or @ref OUTPUT
@@ -30,7 +47,7 @@
 void GPIO_mode( uint8_t port, uint8_t bit, uint8_t mode );
 
 /**
- * Sets the state of the specified GPIO pin.
+ * Sets the state of the specified GPIO pin. Ignored if the port is invalid.
  * @param[in] port		GPIO port, 1 to 6
  * @param[in] bit		GPIO port bit, 0 to 7
  * @param[in] value		@ref LOW or @ref HIGH
@@ -41,20 +58,73 @@ void GPIO_set( uint8_t port, uint8_t bit, uint8_t value );
  * Returns the state of the specified GPIO  pin.
  * @param[in] port		GPIO port, 1 to 6
  * @param[in] bit		GPIO port bit, 0 to 7
- * @return 				@ref LOW or @ref HIGH
+ * @return 				@ref LOW or @ref HIGH. @ref LOW if the port is invalid.
  */
 uint8_t GPIO_get( uint8_t port, uint8_t bit );
 
 /**
- * Toggles the state of the specified GPIO  pin.
+ * Toggles the state of the specified GPIO  pin. Ignored if the port is invalid.
  * @param[in] port		GPIO port, 1 to 6
  * @param[in] bit		GPIO port bit, 0 to 7
  */
 void GPIO_toggle( uint8_t port, uint8_t bit );
 
+/**
+ * Sets the state of all pins of a port. Ignored if the port is invalid.
+ * @param[in] port		GPIO port, 1 to 6
+ * @param[in] value		Pin states, bit n for pin n.
+ */
+void GPIO_writePort( uint8_t port, uint8_t value );
+
+/**
+ * Returns the state of all pins of a port.
+ * @param[in] port		GPIO port, 1 to 6
+ * @return 				Pin states, bit n for pin n. 0 if the port is invalid.
+ */
+uint8_t GPIO_readPort( uint8_t port );
+
+/**
+ * Sets the state of the masked pins of a port in a single write,
+ * leaving the other pins unchanged. The update is atomic with
+ * respect to interrupts. Ignored if the port is invalid.
+ * @param[in] port		GPIO port, 1 to 6
+ * @param[in] mask		Pins to update, bit n for pin n.
+ * @param[in] value		Pin states, bit n for pin n.
+ */
+void GPIO_writeMasked( uint8_t port, uint8_t mask, uint8_t value );
+
+/**
+ * Initializes a pin group and sets the direction of its pins. If the
+ * port is invalid or the mask is 0, the group is left empty: it is
+ * not written, and reads as 0.
+ * @param[out] group	The pin group.
+ * @param[in] port		GPIO port, 1 to 6
+ * @param[in] mask		Pins of the group, bit n for pin n. Not 0.
+ * @param[in] mode		@ref INPUT or @ref OUTPUT
+ */
+void GPIO_groupInit( GPIO_group_t* group, uint8_t port, uint8_t mask, uint8_t mode );
+
+/**
+ * Sets the state of the pins of a group in a single write. The value
+ * is aligned to the lowest pin of the group: e.g. for pins 4 to 7,
+ * bit 0 of the value sets pin 4.
+ * @param[in] group		The pin group.
+ * @param[in] value		Pin states.
+ */
+void GPIO_groupWrite( const GPIO_group_t* group, uint8_t value );
+
+/**
+ * Returns the state of the pins of a group, aligned to the lowest
+ * pin of the group.
+ * @param[in] group		The pin group.
+ * @return 				Pin states.
+ */
+uint8_t GPIO_groupRead( const GPIO_group_t* group );
+
 /**
  * Sets the internal Pull-up/Pull-down resistors of
- * the specified GPIO pin.
+ * the specified GPIO pin. Has no effect on devices
+ * without internal resistors, such as the MSP430F1xx.
  * @param[in] port		GPIO port, 1 to 6
  * @param[in] bit		GPIO port bit, 0 to 7
  * @param[in] pull		@ref NOPULL, @ref PULLUP or @ref PULLDOWN
@@ -63,13 +133,25 @@ void GPIO_pull( uint8_t port, uint8_t bit, uint8_t pull );
 
 /**
  * Enables the GPIO interrupt of the specified GPIO pin.
- * @param[in] port		GPIO port, 1 to 6
+ * @param[in] port		GPIO port, 1 to 2. Other ports have no interrupts.
  * @param[in] bit		GPIO port bit, 0 to 7
- * @param[in] callback	Function to be called on interrupt. Can be NULL.
- * @param[in] mode		@ref LEVEL, @ref RISING edge or @ref FALLING  edge.
+ * @param[in] callback	Function to be called on interrupt, with the pin as specified
+ * 						in @ref pin_map.h. Can be NULL.
+ * @param[in] mode		@ref LEVEL, @ref RISING edge or @ref FALLING  edge,
+ * 						optionally OR'ed with @ref GPIO_WAKEUP.
+ * @attention The callback is called from the interrupt handler.
  */
 void GPIO_attachInterrupt( uint8_t port, uint8_t bit, void ( *callback )( unsigned int ), uint8_t mode );
 
+/**
+ * Enables again the @ref LEVEL interrupt of the specified GPIO pin, after
+ * the device driving the pin has been served. The interrupt is taken at
+ * once if the pin is still low. Has no effect on edge interrupts.
+ * @param[in] port		GPIO port, 1 to 2
+ * @param[in] bit		GPIO port bit, 0 to 7
+ */
+void GPIO_rearmInterrupt( uint8_t port, uint8_t bit );
+
 /**
  * Disables the GPIO interrupt of the specified GPIO pin.
  * @param[in] port		GPIO port, 1 to 6
@@ -106,9 +188,10 @@ int digitalRead( int pin );
 
 /**
  * Enables the GPIO interrupt of the specified GPIO pin.
- * @param[in] pin		GPIO pin as specified in @ref pin_map.h
- * @param[in] callback	Function to be called on interrupt. Can be NULL.
- * @param[in] mode		@ref LEVEL, @ref RISING edge or @ref FALLING  edge.
+ * @param[in] pin		GPIO pin as specified in @ref pin_map.h. P1 and P2 only.
+ * @param[in] callback	Function to be called on interrupt, with the pin. Can be NULL.
+ * @param[in] mode		@ref LEVEL, @ref RISING edge or @ref FALLING  edge,
+ * 						optionally OR'ed with @ref GPIO_WAKEUP.
  */
 void attachInterrupt( int pin, void ( *callback )( unsigned int ), int mode );
 
@@ -118,4 +201,184 @@ void attachInterrupt( int pin, void ( *callback )( unsigned int ), int mode );
  */
 void detachInterrupt( int pin );
 
+/**
+ * Enables again the @ref LEVEL interrupt of the specified GPIO pin.
+ * See @ref GPIO_rearmInterrupt( ).
+ * @param[in] pin		GPIO pin as specified in @ref pin_map.h
+ */
+void rearmInterrupt( int pin );
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+// Fast path
+//
+// When the pin is a compile time constant, such as P1_0, the register
+// and mask are resolved by the compiler and the access compiles to a
+// single instruction, as P1OUT |= BIT0 would. Other pins fall back to
+// the functions above. A constant pin of an invalid port is a compile
+// error. Requires optimization to be enabled.
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns 1 if pin is a compile time constant. A constant pin of an
+ * invalid port fails to compile, see @ref GPIO_invalidPort( ).
+ */
+#define GPIO_isConstPin( pin )	__builtin_constant_p( pin )
+
+/**
+ * Not defined anywhere: the fast path calls it for a constant pin of
+ * an invalid port, which the compiler reports as an error.
+ */
+extern void GPIO_invalidPort( void ) __attribute__( ( error( "GPIO port must be 1 to 6" ) ) );
+
+/**
+ * Returns the input register of a port.
+ * @param[in] port		GPIO port, 1 to 6
+ * @return				The register, or NULL if the port is invalid.
+ */
+static inline const volatile unsigned char* GPIO_regIN( uint8_t port )
+{
+	switch( port )
+	{
+	case 1: return &P1IN;
+	case 2: return &P2IN;
+	case 3: return &P3IN;
+	case 4: return &P4IN;
+	case 5: return &P5IN;
+	case 6: return &P6IN;
+	default:
+		if( __builtin_constant_p( port ) )
+			GPIO_invalidPort( );
+		return NULL;
+	}
+}
+
+/**
+ * Returns the output register of a port.
+ * @param[in] port		GPIO port, 1 to 6
+ * @return				The register, or NULL if the port is invalid.
+ */
+static inline volatile unsigned char* GPIO_regOUT( uint8_t port )
+{
+	switch( port )
+	{
+	case 1: return &P1OUT;
+	case 2: return &P2OUT;
+	case 3: return &P3OUT;
+	case 4: return &P4OUT;
+	case 5: return &P5OUT;
+	case 6: return &P6OUT;
+	default:
+		if( __builtin_constant_p( port ) )
+			GPIO_invalidPort( );
+		return NULL;
+	}
+}
+
+/**
+ * Returns the direction register of a port.
+ * @param[in] port		GPIO port, 1 to 6
+ * @return				The register, or NULL if the port is invalid.
+ */
+static inline volatile unsigned char* GPIO_regDIR( uint8_t port )
+{
+	switch( port )
+	{
+	case 1: return &P1DIR;
+	case 2: return &P2DIR;
+	case 3: return &P3DIR;
+	case 4: return &P4DIR;
+	case 5: return &P5DIR;
+	case 6: return &P6DIR;
+	default:
+		if( __builtin_constant_p( port ) )
+			GPIO_invalidPort( );
+		return NULL;
+	}
+}
+
+/**
+ * Returns the function select register of a port.
+ * @param[in] port		GPIO port, 1 to 6
+ * @return				The register, or NULL if the port is invalid.
+ */
+static inline volatile unsigned char* GPIO_regSEL( uint8_t port )
+{
+	switch( port )
+	{
+	case 1: return &P1SEL;
+	case 2: return &P2SEL;
+	case 3: return &P3SEL;
+	case 4: return &P4SEL;
+	case 5: return &P5SEL;
+	case 6: return &P6SEL;
+	default:
+		if( __builtin_constant_p( port ) )
+			GPIO_invalidPort( );
+		return NULL;
+	}
+}
+
+/**
+ * Sets the state of the specified GPIO pin.
+ * @param[in] pin		GPIO pin as specified in @ref pin_map.h
+ * @param[in] value		@ref LOW or @ref HIGH
+ */
+static inline void digitalWriteFast( int pin, int value )
+{
+	if( GPIO_isConstPin( pin ) )
+	{
+		if( value )
+			*GPIO_regOUT( mapPinToPort( pin ) ) |= ( 1 << mapPinToBit( pin ) );
+		else
+			*GPIO_regOUT( mapPinToPort( pin ) ) &= ~( 1 << mapPinToBit( pin ) );
+	}
+	else
+		digitalWrite( pin, value );
+}
+
+/**
+ * Returns the state of the specified GPIO pin.
+ * @param[in] pin		GPIO pin as specified in @ref pin_map.h
+ * @return 				@ref LOW or @ref HIGH
+ */
+static inline int digitalReadFast( int pin )
+{
+	if( GPIO_isConstPin( pin ) )
+		return ( *GPIO_regIN( mapPinToPort( pin ) ) & ( 1 << mapPinToBit( pin ) ) ) ? HIGH : LOW;
+	else
+		return digitalRead( pin );
+}
+
+/**
+ * Toggles the state of the specified GPIO pin.
+ * @param[in] pin		GPIO pin as specified in @ref pin_map.h
+ */
+static inline void digitalToggleFast( int pin )
+{
+	if( GPIO_isConstPin( pin ) )
+		*GPIO_regOUT( mapPinToPort( pin ) ) ^= ( 1 << mapPinToBit( pin ) );
+	else
+		GPIO_toggle( mapPinToPort( pin ), mapPinToBit( pin ) );
+}
+
+/**
+ * Sets the GPIO pin direction.
+ * @param[in] pin		GPIO pin as specified in @ref pin_map.h
+ * @param[in] mode		@ref INPUT or @ref OUTPUT
+ */
+static inline void pinModeFast( int pin, int mode )
+{
+	if( GPIO_isConstPin( pin ) )
+	{
+		*GPIO_regSEL( mapPinToPort( pin ) ) &= ~( 1 << mapPinToBit( pin ) );
+		if( mode == OUTPUT )
+			*GPIO_regDIR( mapPinToPort( pin ) ) |= ( 1 << mapPinToBit( pin ) );
+		else
+			*GPIO_regDIR( mapPinToPort( pin ) ) &= ~( 1 << mapPinToBit( pin ) );
+	}
+	else
+		pinMode( pin, mode );
+}
+
 #endif
@@ -0,0 +1,187 @@
+#include "instrument.h"
+#include "types.h"
+
+#if INSTRUMENT_ENABLE
+
+#include "critical.h"
+#include "serial.h"
+
+#include <msp430.h>
+#include <signal.h>
+
+static instrument_stats_t instrument_isrStats[INSTRUMENT_NUM_ISRS];
+
+static volatile uint16_t instrument_overflows;	/* TAR overflows, the upper half of the extended counter */
+static uint32_t instrument_start;				/* Extended counter when the statistics were cleared */
+static uint32_t instrument_idle;				/* Time in low power mode, interrupts included */
+static uint32_t instrument_sleepStart;
+static volatile uint32_t instrument_sleepIsr;	/* Time in interrupts while in low power mode */
+static volatile uint8_t instrument_sleeping;
+
+static const char* const instrument_isrNames[INSTRUMENT_NUM_ISRS] =
+{
+	"TIMERA", "UART0_RX", "UART0_TX", "UART1_RX", "UART1_TX", "PORT1", "PORT2"
+};
+
+static uint32_t instrument_now( void );
+static void instrument_putNumber( int uart, uint32_t value );
+
+void instrument_init( void )
+{
+	/* Count TAR overflows. */
+	TACTL &= ~TAIFG;
+	TACTL |= TAIE;
+
+	instrument_reset( );
+}
+
+void instrument_reset( void )
+{
+	int i;
+	critical_state_t state = critical_enter( );
+
+	for( i = 0; i < INSTRUMENT_NUM_ISRS; i++ )
+	{
+		instrument_isrStats[i].count = 0;
+		instrument_isrStats[i].total = 0;
+		instrument_isrStats[i].min = 0;
+		instrument_isrStats[i].max = 0;
+	}
+
+	instrument_start = instrument_now( );
+	instrument_idle = 0;
+	instrument_sleepIsr = 0;
+
+	critical_exit( state );
+}
+
+int instrument_getIsrStats( int id, instrument_stats_t* stats )
+{
+	if( id < 0 || id >= INSTRUMENT_NUM_ISRS )
+		return 0;
+
+	critical_state_t state = critical_enter( );
+	*stats = instrument_isrStats[id];
+	critical_exit( state );
+
+	return 1;
+}
+
+uint8_t instrument_getIdlePercent( void )
+{
+	critical_state_t state = critical_enter( );
+	uint32_t elapsed = instrument_now( ) - instrument_start;
+	uint32_t idle = instrument_idle;
+	uint32_t isr = instrument_sleepIsr;
+	critical_exit( state );
+
+	idle = ( idle > isr ) ? idle - isr : 0;
+
+	/* Scale down first: idle * 100 does not fit in 32 bits. */
+	elapsed /= 100;
+	if( elapsed == 0 )
+		return 0;
+
+	idle /= elapsed;
+	return ( idle > 100 ) ? 100 : idle;
+}
+
+void instrument_dump( int uart )
+{
+	instrument_stats_t stats;
+	int i;
+
+	for( i = 0; i < INSTRUMENT_NUM_ISRS; i++ )
+	{
+		instrument_getIsrStats( i, &stats );
+
+		serial_putstr( uart, instrument_isrNames[i] );
+		serial_putstr( uart, " count=" );
+		instrument_putNumber( uart, stats.count );
+		serial_putstr( uart, " min=" );
+		instrument_putNumber( uart, stats.min );
+		serial_putstr( uart, " max=" );
+		instrument_putNumber( uart, stats.max );
+		serial_putstr( uart, " total=" );
+		instrument_putNumber( uart, stats.total );
+		serial_putstr( uart, "\r\n" );
+	}
+
+	serial_putstr( uart, "idle=" );
+	instrument_putNumber( uart, instrument_getIdlePercent( ) );
+	serial_putstr( uart, "%\r\n" );
+}
+
+void instrument_record( instrument_stats_t* stats, uint16_t time )
+{
+	if( stats->count == 0 || time < stats->min )
+		stats->min = time;
+	if( time > stats->max )
+		stats->max = time;
+
+	stats->total += time;
+	stats->count++;
+}
+
+void instrument_isrExit( int id, uint16_t time )
+{
+	instrument_record( &instrument_isrStats[id], time );
+
+	/* An interrupt serviced in low power mode is not idle time. */
+	if( instrument_sleeping )
+		instrument_sleepIsr += time;
+}
+
+void instrument_sleepEnter( void )
+{
+	instrument_sleepStart = instrument_now( );
+	instrument_sleeping = 1;
+}
+
+void instrument_sleepExit( void )
+{
+	instrument_sleeping = 0;
+	instrument_idle += instrument_now( ) - instrument_sleepStart;
+}
+
+/**
+ * Returns TAR extended to 32 bits by the overflow count.
+ * Must be called with interrupts disabled.
+ */
+static uint32_t instrument_now( void )
+{
+	uint16_t overflows = instrument_overflows;
+	uint16_t counts = TAR;
+
+	/* An overflow may be pending: TAR wrapped but the
+	 * interrupt has not counted it yet. */
+	if( ( TACTL & TAIFG ) && counts < 0x8000 )
+		overflows++;
+
+	return ( ( uint32_t )overflows << 16 ) | counts;
+}
+
+static void instrument_putNumber( int uart, uint32_t value )
+{
+	char buffer[11];
+	int i = sizeof( buffer ) - 1;
+
+	buffer[i] = '\0';
+	do
+	{
+		buffer[--i] = '0' + ( value % 10 );
+		value /= 10;
+	} while( value );
+
+	serial_putstr( uart, &buffer[i] );
+}
+
+__attribute__( ( __interrupt__( TIMERA1_VECTOR ) ) )
+void instrument_TIMERA1_IRQ( void )
+{
+	/* Reading TAIV clears the highest pending flag. */
+	if( TAIV == TAIV_TAIFG )
+		instrument_overflows++;
+}
+
+#endif
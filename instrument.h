@@ -0,0 +1,137 @@
+/**
+ * @Brief Measures the CPU time spent in interrupts and timer callbacks.
+ *
+ * The interrupt handlers of the library timestamp their entry and exit
+ * with TimerA's counter (TAR), and accumulate the minimum, maximum and
+ * total time of each handler. The callbacks of the software timers are
+ * measured the same way, per timer, see @ref timer_t. The time spent in
+ * low power mode by @ref delay_sleep( ) gives the idle percentage.
+ *
+ * The times are in TimerA clock periods, as configured by @ref timer_init( ).
+ * A short handler may measure 0 with a slow timer clock.
+ *
+ * The instrumentation is compiled only when @ref INSTRUMENT_ENABLE is 1,
+ * and costs nothing otherwise. When enabled, it adds about 36 simulated
+ * cycles to each instrumented interrupt, and about 34 to each timer
+ * callback, see sim/sim.h: a timer tick takes 99 cycles instead of 63.
+ * The thresholds of the benchmarks in bench/ are for the build without
+ * it.
+ */
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include "types.h"
+#include <msp430.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Enables the instrumentation. */
+#ifndef INSTRUMENT_ENABLE
+#define INSTRUMENT_ENABLE		0
+#endif
+
+/** Instrumented interrupt handlers. */
+enum
+{
+	INSTRUMENT_ISR_TIMERA,		/**< Timer interrupt, including the timer callbacks. */
+	INSTRUMENT_ISR_UART0_RX,	/**< Serial port 0 receive interrupt. */
+	INSTRUMENT_ISR_UART0_TX,	/**< Serial port 0 transmit interrupt. */
+	INSTRUMENT_ISR_UART1_RX,	/**< Serial port 1 or SPI receive interrupt. */
+	INSTRUMENT_ISR_UART1_TX,	/**< Serial port 1 transmit interrupt. */
+	INSTRUMENT_ISR_PORT1,		/**< P1 pin interrupt, including the GPIO callbacks. */
+	INSTRUMENT_ISR_PORT2,		/**< P2 pin interrupt, including the GPIO callbacks. */
+	INSTRUMENT_NUM_ISRS
+};
+
+/**
+ * Execution time statistics, in TimerA clock periods.
+ */
+typedef struct
+{
+	uint32_t count;		/**< Number of executions. */
+	uint32_t total;		/**< Total time. */
+	uint16_t min;		/**< Shortest execution. */
+	uint16_t max;		/**< Longest execution. */
+} instrument_stats_t;
+
+#if INSTRUMENT_ENABLE
+
+/** Timestamps the entry of an interrupt handler. */
+#define INSTRUMENT_ISR_ENTER( id )		uint16_t _instrument_start = TAR
+
+/** Timestamps the exit of an interrupt handler. */
+#define INSTRUMENT_ISR_EXIT( id )		instrument_isrExit( ( id ), TAR - _instrument_start )
+
+/** Measures a call into stats. */
+#define INSTRUMENT_CALL( stats, call )						\
+	do {													\
+		uint16_t _instrument_call = TAR;					\
+		call;												\
+		instrument_record( ( stats ), TAR - _instrument_call );	\
+	} while( 0 )
+
+/** Marks the entry to low power mode. Interrupts must be disabled. */
+#define INSTRUMENT_SLEEP_ENTER( )		instrument_sleepEnter( )
+
+/** Marks the wake-up from low power mode. Interrupts must be disabled. */
+#define INSTRUMENT_SLEEP_EXIT( )		instrument_sleepExit( )
+
+/**
+ * Starts the instrumentation and clears the statistics.
+ * Must be called after @ref timer_init( ). Uses the TimerA
+ * overflow interrupt to extend TAR for the idle time.
+ */
+void instrument_init( void );
+
+/**
+ * Clears the statistics and restarts the idle time measurement.
+ */
+void instrument_reset( void );
+
+/**
+ * Returns the statistics of an interrupt handler.
+ * @param[in] id		Interrupt handler, one of INSTRUMENT_ISR_XXX.
+ * @param[out] stats	Stores the statistics.
+ * @return 1 on success, 0 if id is invalid.
+ */
+int instrument_getIsrStats( int id, instrument_stats_t* stats );
+
+/**
+ * Returns the percentage of time spent in low power mode since the
+ * statistics were cleared. The time spent in interrupts is excluded.
+ * @return Idle percentage, 0 to 100.
+ * @attention TimerA's extended counter wraps after 2^32 clock periods;
+ * clear the statistics more often than that.
+ */
+uint8_t instrument_getIdlePercent( void );
+
+/**
+ * Writes the statistics of the interrupt handlers and the idle
+ * percentage to a serial port, one line each.
+ * @param[in] uart	Serial port, see @ref serial_init( ).
+ */
+void instrument_dump( int uart );
+
+/* Used by the macros above. */
+void instrument_record( instrument_stats_t* stats, uint16_t time );
+void instrument_isrExit( int id, uint16_t time );
+void instrument_sleepEnter( void );
+void instrument_sleepExit( void );
+
+#else
+
+#define INSTRUMENT_ISR_ENTER( id )
+#define INSTRUMENT_ISR_EXIT( id )
+#define INSTRUMENT_CALL( stats, call )	call
+#define INSTRUMENT_SLEEP_ENTER( )
+#define INSTRUMENT_SLEEP_EXIT( )
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,88 +2,282 @@
 #include "fifo.h"
 #include "types.h"
 #include "clock.h"
+#include "usart.h"
+#include "critical.h"
+#include "instrument.h"
 
 #include <msp430.h>
 #include <signal.h>
 
+/** Returns 1 if uart is a valid serial port, 0 otherwise. */
+#define serial_isValid( uart )	( ( uart ) >= 0 && ( uart ) < SERIAL_NUM_PORTS )
+
+static volatile uint16_t serial_rxOverruns[SERIAL_NUM_PORTS];
+static uint32_t serial_baudRate[SERIAL_NUM_PORTS];
+static uint16_t serial_clockSource[SERIAL_NUM_PORTS];
+static clock_listener_t serial_clockListener[SERIAL_NUM_PORTS];
+
 static void serial_setBaud( int uart, uint32_t baud_rate, uint16_t clock_source );
+static void serial_setDivider( int uart, const usart_divider_t* div );
+static void serial_retime( void* user );
+static void serial_prepareRetime( void* user );
 static void serial_setMode( int uart, uint8_t mode );
+static inline void serial_rxHandler( int uart );
+static inline void serial_txHandler( int uart );
 
-Fifo_t serial_rxFifo;
+/**
+ * USART registers and control bits of each serial port.
+ */
+static const struct
+{
+	volatile unsigned char* UCTL;
+	volatile unsigned char* UTCTL;
+	volatile unsigned char* URCTL;
+	volatile unsigned char* UMCTL;
+	volatile unsigned char* UBR0;
+	volatile unsigned char* UBR1;
+	const volatile unsigned char* RXBUF;
+	volatile unsigned char* TXBUF;
+	volatile unsigned char* ME;
+	volatile unsigned char* IE;
+	volatile unsigned char* IFG;
+	uint8_t UE;			/**< Transmit and receive enable bits in ME. */
+	uint8_t URXIE;		/**< Receive interrupt enable bit in IE. */
+	uint8_t UTXIE;		/**< Transmit interrupt enable bit in IE. */
+	uint8_t URXIFG;		/**< Receive interrupt flag bit in IFG. */
+	uint8_t UTXIFG;		/**< Transmit interrupt flag bit in IFG. */
+	uint8_t PINS;		/**< TX and RX pins in P3SEL. */
+} serial_portTable[] =
+{
+	/* USART0: TX=P3.4, RX=P3.5 */
+	{ .UCTL = &UCTL0, .UTCTL = &UTCTL0, .URCTL = &URCTL0, .UMCTL = &UMCTL0,
+	  .UBR0 = &UBR00, .UBR1 = &UBR10, .RXBUF = &RXBUF0, .TXBUF = &TXBUF0,
+	  .ME = &ME1, .IE = &IE1, .IFG = &IFG1,
+	  .UE = URXE0 | UTXE0, .URXIE = URXIE0, .UTXIE = UTXIE0,
+	  .URXIFG = URXIFG0, .UTXIFG = UTXIFG0,
+	  .PINS = ( 1 << 4 ) | ( 1 << 5 ) },
+
+	/* USART1: TX=P3.6, RX=P3.7 */
+	{ .UCTL = &UCTL1, .UTCTL = &UTCTL1, .URCTL = &URCTL1, .UMCTL = &UMCTL1,
+	  .UBR0 = &UBR01, .UBR1 = &UBR11, .RXBUF = &RXBUF1, .TXBUF = &TXBUF1,
+	  .ME = &ME2, .IE = &IE2, .IFG = &IFG2,
+	  .UE = URXE1 | UTXE1, .URXIE = URXIE1, .UTXIE = UTXIE1,
+	  .URXIFG = URXIFG1, .UTXIFG = UTXIFG1,
+	  .PINS = ( 1 << 6 ) | ( 1 << 7 ) }
+};
+
+FIFO_DEFINE( serial_rxFifo0, SERIAL_RX_BUFFER_SIZE );
+FIFO_DEFINE( serial_txFifo0, SERIAL_TX_BUFFER_SIZE );
+#if SERIAL_NUM_PORTS > 1
+FIFO_DEFINE( serial_rxFifo1, SERIAL_RX_BUFFER_SIZE );
+FIFO_DEFINE( serial_txFifo1, SERIAL_TX_BUFFER_SIZE );
+#endif
+
+/**
+ * Run-time state of each serial port.
+ */
+static const struct
+{
+	Fifo_t* rxFifo;
+	Fifo_t* txFifo;
+} serial_ports[SERIAL_NUM_PORTS] =
+{
+	{ .rxFifo = &serial_rxFifo0, .txFifo = &serial_txFifo0 },
+#if SERIAL_NUM_PORTS > 1
+	{ .rxFifo = &serial_rxFifo1, .txFifo = &serial_txFifo1 },
+#endif
+};
 
 int serial_init( int uart, uint8_t mode, uint32_t baud_rate, uint16_t clock_source )
 {
-	Fifo_init( &serial_rxFifo );
+	if( !serial_isValid( uart ) )
+		return 0;
 
-	/* select UART pins TX=P3.4, RX=P3.5 */
-    P3SEL |= ( 1 << 4 ) | ( 1 << 5 );
+	/* keep in soft reset while configuring. The interrupts of a port
+	 * that is already running must not see the FIFOs being reset. */
+	*serial_portTable[uart].UCTL = SWRST;
+	*serial_portTable[uart].IE &= ~( serial_portTable[uart].URXIE | serial_portTable[uart].UTXIE );
 
-	/* keep in soft reset while configuring */
-	UCTL0  = SWRST;
+	Fifo_init( serial_ports[uart].rxFifo, serial_ports[uart].rxFifo->buffer, SERIAL_RX_BUFFER_SIZE );
+	Fifo_init( serial_ports[uart].txFifo, serial_ports[uart].txFifo->buffer, SERIAL_TX_BUFFER_SIZE );
+	serial_rxOverruns[uart] = 0;
+
+	/* select UART pins */
+    P3SEL |= serial_portTable[uart].PINS;
 
 	/* select clock source */
 	if( clock_source == SMCLK )
-		UTCTL0 = SSEL1;
+		*serial_portTable[uart].UTCTL = SSEL1;
 	else
-		UTCTL0 = SSEL0;	/* Defaults to ACLK */
+		*serial_portTable[uart].UTCTL = SSEL0;	/* Defaults to ACLK */
 
 	/* configure Rx Ctrl Register. */
-	URCTL0 = 0;
+	*serial_portTable[uart].URCTL = 0;
 
 	serial_setMode( uart, mode );
     serial_setBaud( uart, baud_rate, clock_source );
+	serial_baudRate[uart] = baud_rate;
+	serial_clockSource[uart] = clock_source;
 
     /* enable transmit and receive */
-    ME1 |= URXE0 | UTXE0;
+    *serial_portTable[uart].ME |= serial_portTable[uart].UE;
 
     /* remove reset */
-    UCTL0 &= ~SWRST;
+    *serial_portTable[uart].UCTL &= ~SWRST;
+
+    /* enable receive interrupt */
+    *serial_portTable[uart].IE |= serial_portTable[uart].URXIE;
 
-    /* enable receive interrupt for USART0 */
-    IE1 |= URXIE0;
+	/* recompute the dividers when the clock frequency changes */
+	serial_clockListener[uart].callback = serial_retime;
+	serial_clockListener[uart].prepare = serial_prepareRetime;
+	serial_clockListener[uart].user = ( void* )( intptr_t )uart;
+	clock_subscribe( &serial_clockListener[uart] );
 
 	return 1;
 }
 
 int serial_uninit( int uart )
 {
+	if( !serial_isValid( uart ) )
+		return 0;
+
  	/* keep in soft reset */
-	UCTL0 |= SWRST;
+	*serial_portTable[uart].UCTL |= SWRST;
 	/* disable transmit and receive */
-    ME1   &= ~( URXE0 | UTXE0 );
+    *serial_portTable[uart].ME &= ~serial_portTable[uart].UE;
+    *serial_portTable[uart].IE &= ~( serial_portTable[uart].URXIE | serial_portTable[uart].UTXIE );
+	clock_unsubscribe( &serial_clockListener[uart] );
 	return 1;
 }
 
 int serial_available( int uart )
 {
-    return Fifo_available( &serial_rxFifo );
+	if( !serial_isValid( uart ) )
+		return 0;
+
+    return Fifo_available( serial_ports[uart].rxFifo );
 }
 
 int serial_read( int uart )
 {
-	return Fifo_pop( &serial_rxFifo );
+	if( !serial_isValid( uart ) )
+		return EOF;
+
+	uint8_t c;
+	if( !Fifo_get( serial_ports[uart].rxFifo, &c ) )
+		return EOF;
+
+	return c;
 }
 
+int serial_readBuffer( int uart, uint8_t* buffer, uint16_t size )
+{
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	return Fifo_read( serial_ports[uart].rxFifo, buffer, size );
+}
+
+int serial_peekSpan( int uart, const uint8_t** span )
+{
+	if( !serial_isValid( uart ) )
+	{
+		*span = NULL;
+		return 0;
+	}
+
+	return Fifo_peekSpan( serial_ports[uart].rxFifo, span );
+}
+
+int serial_commit( int uart, uint16_t count )
+{
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	Fifo_commit( serial_ports[uart].rxFifo, count );
+	return 1;
+}
 
 int serial_write( int uart, char c )
 {
-	/* Wait until prev char transmited. */
-	while( ( IFG1 & UTXIFG0 ) == 0 );
-	U0TXBUF = c;
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	if( !Fifo_push( serial_ports[uart].txFifo, c ) )
+		return 0;
+
+	/* (Re)start the transmitter. The interrupt fires
+	 * immediately if the Tx buf is empty. */
+	*serial_portTable[uart].IE |= serial_portTable[uart].UTXIE;
+
+	return 1;
+}
+
+int serial_writeBuffer( int uart, const uint8_t* buffer, uint16_t size )
+{
+	uint16_t count = 0;
+
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	while( count < size && Fifo_push( serial_ports[uart].txFifo, buffer[count] ) )
+		count++;
+
+	if( count )
+		*serial_portTable[uart].IE |= serial_portTable[uart].UTXIE;
+
+	return count;
+}
+
+int serial_drain( int uart )
+{
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	/* Wait until the FIFO is empty and the last
+	 * char has left the shift register. */
+	while( Fifo_size( serial_ports[uart].txFifo ) != 0 );
+	while( ( *serial_portTable[uart].UTCTL & TXEPT ) == 0 );
 
 	return 1;
 }
 
 int serial_flush( int uart )
 {
-	Fifo_init( &serial_rxFifo );
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	Fifo_flush( serial_ports[uart].rxFifo );
+	return 1;
+}
+
+int serial_getStats( int uart, serial_stats_t* stats )
+{
+	if( !serial_isValid( uart ) )
+		return 0;
+
+	stats->rx_overruns = serial_rxOverruns[uart];
+	stats->rx_dropped = serial_ports[uart].rxFifo->dropped;
+	stats->rx_peak = serial_ports[uart].rxFifo->peak;
+	stats->tx_dropped = serial_ports[uart].txFifo->dropped;
+	stats->tx_peak = serial_ports[uart].txFifo->peak;
+
 	return 1;
 }
 
 int serial_putstr( int uart, const char* str )
 {
+	if( !serial_isValid( uart ) )
+		return 0;
+
 	while( *str )
+	{
+		/* Wait for room in the transmit FIFO, so that
+		 * waiting is not counted as dropped characters. */
+		while( Fifo_full( serial_ports[uart].txFifo ) );
 		serial_write( uart, *str++ );
+	}
 
 	return 1;
 }
@@ -91,27 +285,71 @@ int serial_putstr( int uart, const char* str )
 
 static void serial_setBaud( int uart, uint32_t baud_rate, uint16_t clock_source )
 {
-    // Assumes uart 0
-	( void )uart;
-
 	/* Set the baudrate dividers and modulation */
-	uint32_t clk = clock_get( clock_source );
-	unsigned int N_div;
-	N_div = clk / baud_rate;
+	usart_divider_t div;
+	usart_calcDivider( clock_get( clock_source ), baud_rate, &div );
+	serial_setDivider( uart, &div );
+}
+
+static void serial_setDivider( int uart, const usart_divider_t* div )
+{
+	*serial_portTable[uart].UBR0 = div->ubr0;
+	*serial_portTable[uart].UBR1 = div->ubr1;
+	*serial_portTable[uart].UMCTL = div->umctl;
+}
 
-	float N_div_f;
-	N_div_f = (float)clk / (float)baud_rate;
+/**
+ * Clock listener: holds a clock change until the characters being
+ * transmitted have been sent, as they would be corrupted by it.
+ * Transmission resumes in serial_retime( ). Reception goes on.
+ */
+static void serial_prepareRetime( void* user )
+{
+	int uart = ( int )( intptr_t )user;
 
-	UBR00 = ( unsigned char )( N_div & 0x00FF );
-	UBR10 = ( unsigned char )( ( N_div & 0xFF00 ) >> 8 );
-	UMCTL0 = ( unsigned char )( ( ( N_div_f - ( int )( N_div_f ) ) ) * 8.0f ) << 1; // Set BRS
+	*serial_portTable[uart].IE &= ~serial_portTable[uart].UTXIE;
+	while( ( *serial_portTable[uart].UTCTL & TXEPT ) == 0 );
 }
 
-static void serial_setMode( int uart, uint8_t mode )
+/**
+ * Clock listener: reprograms the baudrate dividers of a port
+ * for the new clock frequency.
+ */
+static void serial_retime( void* user )
 {
-	// Assumes uart 0.
-	( void )uart;
+	int uart = ( int )( intptr_t )user;
+	usart_divider_t div;
+
+	/* Computed beforehand: the port does not receive in soft reset. */
+	usart_calcDivider( clock_get( serial_clockSource[uart] ), serial_baudRate[uart], &div );
+
+	critical_state_t state = critical_enter( );
+
+	uint8_t ie = *serial_portTable[uart].IE & ( serial_portTable[uart].URXIE | serial_portTable[uart].UTXIE );
+	uint8_t ifg = *serial_portTable[uart].IFG & serial_portTable[uart].URXIFG;
+
+	/* Resume transmitting, if held by serial_prepareRetime( ). */
+	if( !Fifo_empty( serial_ports[uart].txFifo ) )
+		ie |= serial_portTable[uart].UTXIE;
+
+	/* Soft reset would cut the character being shifted out. None is,
+	 * unless the change was made without serial_prepareRetime( ). */
+	while( ( *serial_portTable[uart].UTCTL & TXEPT ) == 0 );
 
+	/* The dividers may only be changed in soft reset, which
+	 * also clears the interrupt enable bits, and the flag of a
+	 * character received but not yet read from RXBUF. */
+	*serial_portTable[uart].UCTL |= SWRST;
+	serial_setDivider( uart, &div );
+	*serial_portTable[uart].UCTL &= ~SWRST;
+	*serial_portTable[uart].IFG |= ifg;
+	*serial_portTable[uart].IE |= ie;
+
+	critical_exit( state );
+}
+
+static void serial_setMode( int uart, uint8_t mode )
+{
 	uint8_t uctl = 0;
 
 	/* Data Word Length */
@@ -134,14 +372,69 @@ static void serial_setMode( int uart, uint8_t mode )
 		uctl |= PENA;
 	}
 
-	UCTL0 |= uctl;
+	*serial_portTable[uart].UCTL |= uctl;
+}
+
+static inline void serial_rxHandler( int uart )
+{
+	/* OE is cleared when RXBUF is read. */
+	if( *serial_portTable[uart].URCTL & OE )
+		serial_rxOverruns[uart]++;
+
+	uint8_t byte = *serial_portTable[uart].RXBUF;
+	Fifo_push( serial_ports[uart].rxFifo, byte );
+}
+
+static inline void serial_txHandler( int uart )
+{
+	uint8_t byte;
+
+	if( Fifo_get( serial_ports[uart].txFifo, &byte ) )
+	{
+		*serial_portTable[uart].TXBUF = byte;
+	}
+	else
+	{
+		/* Nothing left to send. UTXIFG was reset when this
+		 * interrupt was serviced, so set it again for the next
+		 * serial_write( ) to restart the transmitter. */
+		*serial_portTable[uart].IE &= ~serial_portTable[uart].UTXIE;
+		*serial_portTable[uart].IFG |= serial_portTable[uart].UTXIFG;
+	}
 }
 
 __attribute__( ( __interrupt__( USART0RX_VECTOR ) ) )
 void Serial_UART0_IRQ(void)
 {
-	uint8_t byte = RXBUF0;
-	Fifo_push( &serial_rxFifo, byte );
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_UART0_RX );
+	serial_rxHandler( 0 );
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_UART0_RX );
 	__bic_SR_register_on_exit(LPM3_bits);
 }
 
+__attribute__( ( __interrupt__( USART0TX_VECTOR ) ) )
+void Serial_UART0_TX_IRQ(void)
+{
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_UART0_TX );
+	serial_txHandler( 0 );
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_UART0_TX );
+}
+
+#if SERIAL_NUM_PORTS > 1
+__attribute__( ( __interrupt__( USART1RX_VECTOR ) ) )
+void Serial_UART1_IRQ(void)
+{
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_UART1_RX );
+	serial_rxHandler( 1 );
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_UART1_RX );
+	__bic_SR_register_on_exit(LPM3_bits);
+}
+
+__attribute__( ( __interrupt__( USART1TX_VECTOR ) ) )
+void Serial_UART1_TX_IRQ(void)
+{
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_UART1_TX );
+	serial_txHandler( 1 );
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_UART1_TX );
+}
+#endif
@@ -1,12 +1,30 @@
 #ifndef SERIAL_H_
 #define SERIAL_H_
 
-#include "Types.h"
+#include "types.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Number of USART ports used by the serial driver: 1 for USART0 only,
+ * 2 for USART0 and USART1. Set to 1 to leave USART1 free for SPI.
+ */
+#ifndef SERIAL_NUM_PORTS
+#define SERIAL_NUM_PORTS	2
+#endif
+
+/** Size of the receive FIFO of each port. Must be a power of two. */
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE	128
+#endif
+
+/** Size of the transmit FIFO of each port. Must be a power of two. */
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE	128
+#endif
+
 /** Serial Mode definitions */
 #define CHAR_7BIT		( 0x01 )	/**< 7-bit character length */
 #define CHAR_8BIT		( 0x02 )	/**< 8-bit character length */
@@ -16,9 +34,22 @@ extern "C" {
 #define PAR_ODD			( 0x08 )	/**< Odd parity */
 #define PAR_EVEN		( 0x10 )	/**< Even parity */
 
+/**
+ * Serial port statistics.
+ */
+typedef struct
+{
+	uint16_t rx_overruns;	/**< Characters lost because RXBUF was overwritten before it was read. */
+	uint16_t rx_dropped;	/**< Characters lost because the receive FIFO was full. */
+	uint16_t rx_peak;		/**< Highest number of characters in the receive FIFO. */
+	uint16_t tx_dropped;	/**< Characters not queued because the transmit FIFO was full. */
+	uint16_t tx_peak;		/**< Highest number of characters in the transmit FIFO. */
+} serial_stats_t;
+
 /**
  * Initializes the UART hardware.
- * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @param[in] uart			Specifies the MCU USART port to operate on: 0 for USART0, 1 for USART1.
+ * 							All functions return 0, or EOF, if the port is not valid.
  * @param[in] mode 			This is a bitfield that specified the Serial configuration.
  * @param[in] baud_rate		The serial baud rate.
  * @param[in] clock_source 	The clock source of the MCU USART, one of ACLK or SMCLK.
@@ -45,18 +76,62 @@ int serial_available( int uart );
 /**
  * Reads a character.
  * @param[in] uart			Specifies the MCU USART port to operate on.
- * @return	The received character or EOF if not character available.
+ * @return	The received character, 0 to 255, or EOF if no character available.
  */
 int serial_read( int uart );
 
 /**
- * Writes a character.
+ * Reads the received characters into a buffer.
  * @param[in] uart			Specifies the MCU USART port to operate on.
- * @param[in] c				The character.
+ * @param[out] buffer		Stores the received characters.
+ * @param[in] size			Size of buffer.
+ * @return	Returns the number of characters read.
+ */
+int serial_readBuffer( int uart, uint8_t* buffer, uint16_t size );
+
+/**
+ * Returns received characters in place, without copying or
+ * removing them. See @ref Fifo_peekSpan( ).
+ * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @param[out] span			Set to the first received character, or NULL if uart is invalid.
+ * @return	Returns the number of contiguous characters at span.
+ */
+int serial_peekSpan( int uart, const uint8_t** span );
+
+/**
+ * Removes characters returned by @ref serial_peekSpan( ).
+ * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @param[in] count			Number of characters to remove.
  * @return	Returns 1.
  */
+int serial_commit( int uart, uint16_t count );
+
+/**
+ * Queues a character for transmission. Does not block.
+ * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @param[in] c				The character.
+ * @return	Returns 1 if the character was queued, 0 if the transmit FIFO is full.
+ */
 int serial_write( int uart, char c );
 
+/**
+ * Queues a buffer for transmission. Does not block.
+ * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @param[in] buffer		The data to transmit.
+ * @param[in] size			Number of bytes in buffer.
+ * @return	Returns the number of bytes queued, which is less than size
+ * if the transmit FIFO is full.
+ */
+int serial_writeBuffer( int uart, const uint8_t* buffer, uint16_t size );
+
+/**
+ * Waits until all queued characters have been transmitted.
+ * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @return	Returns 1.
+ * @attention Interrupts must be enabled.
+ */
+int serial_drain( int uart );
+
 /**
  * Flushes the UART and discards all the characters received.
  * @param[in] uart			Specifies the MCU USART port to operate on.
@@ -65,13 +140,23 @@ int serial_write( int uart, char c );
 int serial_flush( int uart );
 
 /**
- * Writes a null-terminated string.
+ * Writes a null-terminated string. Blocks only while the
+ * transmit FIFO is full.
  * @param[in] uart			Specifies the MCU USART port to operate on.
  * @param[in] c				The string.
  * @return Returns 1.
  */
 int serial_putstr( int uart, const char* str );
 
+/**
+ * Returns the statistics of the serial port, counted since
+ * @ref serial_init( ). Used to size the FIFOs from field data.
+ * @param[in] uart			Specifies the MCU USART port to operate on.
+ * @param[out] stats		Stores the statistics.
+ * @return	Returns 1.
+ */
+int serial_getStats( int uart, serial_stats_t* stats );
+
 /** Writes a character. Alias for @ref serial_write( ). */
 #define serial_putchar( uart, c )		serial_write( uart, c )
 
@@ -0,0 +1,385 @@
+/**
+ * @Brief Host replacement of <msp430.h> for the MSP430F149.
+ *
+ * The peripheral registers are mapped into a simulated register file,
+ * sim_io, at their MSP430 addresses, so that the library compiles
+ * unchanged on the host, including the static tables that take the
+ * address of a register. The intrinsics are implemented by the
+ * simulator, see sim.h.
+ *
+ * Only the peripherals used by the library are declared.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef SIM_MSP430_H_
+#define SIM_MSP430_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Peripheral address space, 16-bit words: 0x0000 to 0x01FF. */
+#define SIM_IO_SIZE		0x0200
+
+extern volatile uint16_t sim_io[SIM_IO_SIZE / 2];
+
+/** Byte register at an address. */
+#define SIM_SFRB( addr )	( ( ( volatile unsigned char* )sim_io )[addr] )
+
+/** Word register at an address. */
+#define SIM_SFRW( addr )	( sim_io[( addr ) >> 1] )
+
+/* Interrupts run on the host as plain functions, see sim.c. */
+#define __interrupt__( vector )	__used__
+
+/************************************************************
+* STATUS REGISTER BITS
+************************************************************/
+
+#define GIE					0x0008
+#define CPUOFF				0x0010
+#define OSCOFF				0x0020
+#define SCG0				0x0040
+#define SCG1				0x0080
+
+#define LPM0_bits			( CPUOFF )
+#define LPM1_bits			( SCG0 | CPUOFF )
+#define LPM2_bits			( SCG1 | CPUOFF )
+#define LPM3_bits			( SCG1 | SCG0 | CPUOFF )
+#define LPM4_bits			( SCG1 | SCG0 | OSCOFF | CPUOFF )
+
+/************************************************************
+* SPECIAL FUNCTION REGISTER ADDRESSES + CONTROL BITS
+************************************************************/
+
+#define IE1					SIM_SFRB( 0x0000 )
+#define WDTIE				0x01
+#define OFIE				0x02
+#define NMIIE				0x10
+#define ACCVIE				0x20
+#define URXIE0				0x40
+#define UTXIE0				0x80
+
+#define IFG1				SIM_SFRB( 0x0002 )
+#define WDTIFG				0x01
+#define OFIFG				0x02
+#define NMIIFG				0x10
+#define URXIFG0				0x40
+#define UTXIFG0				0x80
+
+#define ME1					SIM_SFRB( 0x0004 )
+#define URXE0				0x40
+#define UTXE0				0x80
+#define USPIE0				0x40
+
+#define IE2					SIM_SFRB( 0x0001 )
+#define URXIE1				0x10
+#define UTXIE1				0x20
+
+#define IFG2				SIM_SFRB( 0x0003 )
+#define URXIFG1				0x10
+#define UTXIFG1				0x20
+
+#define ME2					SIM_SFRB( 0x0005 )
+#define URXE1				0x10
+#define UTXE1				0x20
+#define USPIE1				0x10
+
+/************************************************************
+* DIGITAL I/O Port1/2
+************************************************************/
+
+#define P1IN				SIM_SFRB( 0x0020 )
+#define P1OUT				SIM_SFRB( 0x0021 )
+#define P1DIR				SIM_SFRB( 0x0022 )
+#define P1IFG				SIM_SFRB( 0x0023 )
+#define P1IES				SIM_SFRB( 0x0024 )
+#define P1IE				SIM_SFRB( 0x0025 )
+#define P1SEL				SIM_SFRB( 0x0026 )
+
+#define P2IN				SIM_SFRB( 0x0028 )
+#define P2OUT				SIM_SFRB( 0x0029 )
+#define P2DIR				SIM_SFRB( 0x002A )
+#define P2IFG				SIM_SFRB( 0x002B )
+#define P2IES				SIM_SFRB( 0x002C )
+#define P2IE				SIM_SFRB( 0x002D )
+#define P2SEL				SIM_SFRB( 0x002E )
+
+/************************************************************
+* DIGITAL I/O Port3/4
+************************************************************/
+
+#define P3IN				SIM_SFRB( 0x0018 )
+#define P3OUT				SIM_SFRB( 0x0019 )
+#define P3DIR				SIM_SFRB( 0x001A )
+#define P3SEL				SIM_SFRB( 0x001B )
+
+#define P4IN				SIM_SFRB( 0x001C )
+#define P4OUT				SIM_SFRB( 0x001D )
+#define P4DIR				SIM_SFRB( 0x001E )
+#define P4SEL				SIM_SFRB( 0x001F )
+
+/************************************************************
+* DIGITAL I/O Port5/6
+************************************************************/
+
+#define P5IN				SIM_SFRB( 0x0030 )
+#define P5OUT				SIM_SFRB( 0x0031 )
+#define P5DIR				SIM_SFRB( 0x0032 )
+#define P5SEL				SIM_SFRB( 0x0033 )
+
+#define P6IN				SIM_SFRB( 0x0034 )
+#define P6OUT				SIM_SFRB( 0x0035 )
+#define P6DIR				SIM_SFRB( 0x0036 )
+#define P6SEL				SIM_SFRB( 0x0037 )
+
+/************************************************************
+* USART
+************************************************************/
+
+/* UxCTL */
+#define PENA				0x80
+#define PEV					0x40
+#define SPB					0x20
+#define CHAR				0x10
+#define LISTEN				0x08
+#define SYNC				0x04
+#define MM					0x02
+#define SWRST				0x01
+
+/* UxTCTL */
+#define CKPH				0x80
+#define CKPL				0x40
+#define SSEL1				0x20
+#define SSEL0				0x10
+#define URXSE				0x08
+#define TXWAKE				0x04
+#define STC					0x02
+#define TXEPT				0x01
+
+/* UxRCTL */
+#define FE					0x80
+#define PE					0x40
+#define OE					0x20
+#define BRK					0x10
+#define URXEIE				0x08
+#define URXWIE				0x04
+#define RXWAKE				0x02
+#define RXERR				0x01
+
+#define U0CTL				SIM_SFRB( 0x0070 )
+#define U0TCTL				SIM_SFRB( 0x0071 )
+#define U0RCTL				SIM_SFRB( 0x0072 )
+#define U0MCTL				SIM_SFRB( 0x0073 )
+#define U0BR0				SIM_SFRB( 0x0074 )
+#define U0BR1				SIM_SFRB( 0x0075 )
+#define U0RXBUF				SIM_SFRB( 0x0076 )
+#define U0TXBUF				SIM_SFRB( 0x0077 )
+
+/* Alternate register names */
+#define UCTL0				U0CTL
+#define UTCTL0				U0TCTL
+#define URCTL0				U0RCTL
+#define UMCTL0				U0MCTL
+#define UBR00				U0BR0
+#define UBR10				U0BR1
+#define RXBUF0				U0RXBUF
+#define TXBUF0				U0TXBUF
+
+#define U1CTL				SIM_SFRB( 0x0078 )
+#define U1TCTL				SIM_SFRB( 0x0079 )
+#define U1RCTL				SIM_SFRB( 0x007A )
+#define U1MCTL				SIM_SFRB( 0x007B )
+#define U1BR0				SIM_SFRB( 0x007C )
+#define U1BR1				SIM_SFRB( 0x007D )
+#define U1RXBUF				SIM_SFRB( 0x007E )
+#define U1TXBUF				SIM_SFRB( 0x007F )
+
+/* Alternate register names */
+#define UCTL1				U1CTL
+#define UTCTL1				U1TCTL
+#define URCTL1				U1RCTL
+#define UMCTL1				U1MCTL
+#define UBR01				U1BR0
+#define UBR11				U1BR1
+#define RXBUF1				U1RXBUF
+#define TXBUF1				U1TXBUF
+
+/************************************************************
+* Timer A3
+************************************************************/
+
+#define TAIV				SIM_SFRW( 0x012E )
+#define TACTL				SIM_SFRW( 0x0160 )
+#define TACCTL0				SIM_SFRW( 0x0162 )
+#define TACCTL1				SIM_SFRW( 0x0164 )
+#define TACCTL2				SIM_SFRW( 0x0166 )
+#define TAR					SIM_SFRW( 0x0170 )
+#define TACCR0				SIM_SFRW( 0x0172 )
+#define TACCR1				SIM_SFRW( 0x0174 )
+#define TACCR2				SIM_SFRW( 0x0176 )
+
+/* Alternate register names */
+#define CCTL0				TACCTL0
+#define CCTL1				TACCTL1
+#define CCTL2				TACCTL2
+#define CCR0				TACCR0
+#define CCR1				TACCR1
+#define CCR2				TACCR2
+
+/* TACTL */
+#define TASSEL1				0x0200
+#define TASSEL0				0x0100
+#define ID1					0x0080
+#define ID0					0x0040
+#define MC1					0x0020
+#define MC0					0x0010
+#define TACLR				0x0004
+#define TAIE				0x0002
+#define TAIFG				0x0001
+
+#define MC_0				( 0 * 0x10u )
+#define MC_1				( 1 * 0x10u )
+#define MC_2				( 2 * 0x10u )
+#define MC_3				( 3 * 0x10u )
+#define ID_0				( 0 * 0x40u )
+#define ID_1				( 1 * 0x40u )
+#define ID_2				( 2 * 0x40u )
+#define ID_3				( 3 * 0x40u )
+#define TASSEL_0			( 0 * 0x100u )
+#define TASSEL_1			( 1 * 0x100u )
+#define TASSEL_2			( 2 * 0x100u )
+#define TASSEL_3			( 3 * 0x100u )
+
+/* TACCTLx */
+#define CM1					0x8000
+#define CM0					0x4000
+#define CCIS1				0x2000
+#define CCIS0				0x1000
+#define SCS					0x0800
+#define SCCI				0x0400
+#define CAP					0x0100
+#define OUTMOD2				0x0080
+#define OUTMOD1				0x0040
+#define OUTMOD0				0x0020
+#define CCIE				0x0010
+#define CCI					0x0008
+#define OUT					0x0004
+#define COV					0x0002
+#define CCIFG				0x0001
+
+#define CM_0				( 0 * 0x4000u )
+#define CM_1				( 1 * 0x4000u )
+#define CM_2				( 2 * 0x4000u )
+#define CM_3				( 3 * 0x4000u )
+#define CCIS_0				( 0 * 0x1000u )
+#define CCIS_1				( 1 * 0x1000u )
+#define CCIS_2				( 2 * 0x1000u )
+#define CCIS_3				( 3 * 0x1000u )
+
+/* TAIV */
+#define TAIV_NONE			( 0x0000 )
+#define TAIV_TACCR1			( 0x0002 )
+#define TAIV_TACCR2			( 0x0004 )
+#define TAIV_TAIFG			( 0x000A )
+
+/************************************************************
+* Basic Clock Module
+************************************************************/
+
+#define DCOCTL				SIM_SFRB( 0x0056 )
+#define BCSCTL1				SIM_SFRB( 0x0057 )
+#define BCSCTL2				SIM_SFRB( 0x0058 )
+
+/* DCOCTL */
+#define MOD0				0x01
+#define MOD1				0x02
+#define MOD2				0x04
+#define MOD3				0x08
+#define MOD4				0x10
+#define DCO0				0x20
+#define DCO1				0x40
+#define DCO2				0x80
+
+/* BCSCTL1 */
+#define RSEL0				0x01
+#define RSEL1				0x02
+#define RSEL2				0x04
+#define XT5V				0x08
+#define DIVA0				0x10
+#define DIVA1				0x20
+#define XTS					0x40
+#define XT2OFF				0x80
+
+#define DIVA_0				( 0x00 )
+#define DIVA_1				( 0x10 )
+#define DIVA_2				( 0x20 )
+#define DIVA_3				( 0x30 )
+
+/* BCSCTL2 */
+#define DCOR				0x01
+#define DIVS0				0x02
+#define DIVS1				0x04
+#define SELS				0x08
+#define DIVM0				0x10
+#define DIVM1				0x20
+#define SELM0				0x40
+#define SELM1				0x80
+
+#define DIVM_0				( 0x00 )
+#define DIVM_1				( 0x10 )
+#define DIVM_2				( 0x20 )
+#define DIVM_3				( 0x30 )
+#define DIVS_0				( 0x00 )
+#define DIVS_1				( 0x02 )
+#define DIVS_2				( 0x04 )
+#define DIVS_3				( 0x06 )
+#define SELM_0				( 0x00 )
+#define SELM_1				( 0x40 )
+#define SELM_2				( 0x80 )
+#define SELM_3				( 0xC0 )
+
+/************************************************************
+* Interrupt Vectors (offset from 0xFFE0)
+************************************************************/
+
+#define PORT2_VECTOR		( 1 * 2u )
+#define USART1TX_VECTOR		( 2 * 2u )
+#define USART1RX_VECTOR		( 3 * 2u )
+#define PORT1_VECTOR		( 4 * 2u )
+#define TIMERA1_VECTOR		( 5 * 2u )
+#define TIMERA0_VECTOR		( 6 * 2u )
+#define ADC12_VECTOR		( 7 * 2u )
+#define USART0TX_VECTOR		( 8 * 2u )
+#define USART0RX_VECTOR		( 9 * 2u )
+#define WDT_VECTOR			( 10 * 2u )
+#define COMPARATORA_VECTOR	( 11 * 2u )
+#define TIMERB1_VECTOR		( 12 * 2u )
+#define TIMERB0_VECTOR		( 13 * 2u )
+#define NMI_VECTOR			( 14 * 2u )
+#define RESET_VECTOR		( 15 * 2u )
+
+/************************************************************
+* Intrinsics
+************************************************************/
+
+unsigned int __get_SR_register( void );
+void __bis_SR_register( unsigned int bits );
+void __bic_SR_register( unsigned int bits );
+void __bis_SR_register_on_exit( unsigned int bits );
+void __bic_SR_register_on_exit( unsigned int bits );
+void __enable_interrupt( void );
+void __disable_interrupt( void );
+void __nop( void );
+void __delay_cycles( unsigned long cycles );
+
+#define __no_operation( )	__nop( )
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1396 @@
+#include "sim.h"
+
+#include <msp430.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of interrupt vectors, the reset vector included. */
+#define SIM_NUM_VECTORS			16
+
+/** Vector table index of an XXX_VECTOR offset. */
+#define SIM_IRQ( vector )		( ( vector ) / 2 )
+
+/** Deepest interrupt nesting, NMI included. */
+#define SIM_IRQ_DEPTH			8
+
+/** Cycles accumulated before the peripherals are updated at a function boundary. */
+#define SIM_QUANTUM				32
+
+/** Characters kept per USART, see sim_uartReceive( ). */
+#define SIM_UART_LOG_SIZE		8192
+
+/** Characters queued per USART, see sim_uartSend( ). */
+#define SIM_UART_RX_SIZE		1024
+
+/** Largest baud rate error tolerated by the UART peer. */
+#define SIM_UART_BAUD_TOLERANCE	0.03
+
+/** DCO frequency ratio between adjacent DCO taps. */
+#define SIM_DCO_STEP			1.112
+
+/** Events of the peripherals, see sim_advance( ). */
+enum
+{
+	SIM_EVENT_NONE,
+	SIM_EVENT_TIMER,		/* TAR reaches a compare value or overflows */
+	SIM_EVENT_ACLK,			/* ACLK rising edge, captured by CCR2 */
+	SIM_EVENT_SHIFT0,		/* USART0 shift register empties */
+	SIM_EVENT_SHIFT1,
+	SIM_EVENT_RX0,			/* USART0 receives a character */
+	SIM_EVENT_RX1,
+	SIM_EVENT_CRYSTAL		/* A crystal becomes stable */
+};
+
+/**
+ * State of a USART, beyond its registers.
+ */
+typedef struct
+{
+	uint8_t shifting;		/* Shift register busy */
+	uint8_t buffered;		/* TXBUF holds a character for the shift register */
+	uint8_t corrupt;		/* The character being shifted is corrupted */
+	uint8_t shiftData;
+	uint8_t txData;
+	double shiftTime;		/* Character time when the shift started */
+	double shiftEnd;		/* Time the shift register empties */
+
+	uint8_t rx[SIM_UART_RX_SIZE];
+	uint16_t rxHead;
+	uint16_t rxCount;
+	double rxNext;			/* Arrival of rx[rxHead] */
+
+	uint8_t log[SIM_UART_LOG_SIZE];
+	uint16_t logSize;
+	uint16_t errors;
+	uint32_t baud;			/* Baud rate of the peer, 0 to accept any */
+} sim_usart_t;
+
+/**
+ * Registers and interrupt bits of a USART.
+ */
+static const struct
+{
+	uint16_t base;			/* UxCTL; the other registers follow */
+	uint16_t ie;
+	uint16_t ifg;
+	uint16_t me;
+	uint8_t rx;				/* URXIEx, URXIFGx, URXEx and USPIEx */
+	uint8_t tx;				/* UTXIEx, UTXIFGx and UTXEx */
+} sim_usartRegs[2] =
+{
+	{ 0x0070, 0x0000, 0x0002, 0x0004, URXIE0, UTXIE0 },
+	{ 0x0078, 0x0001, 0x0003, 0x0005, URXIE1, UTXIE1 }
+};
+
+/* Offsets from UxCTL. */
+#define SIM_UCTL		0
+#define SIM_UTCTL		1
+#define SIM_URCTL		2
+#define SIM_UMCTL		3
+#define SIM_UBR0		4
+#define SIM_UBR1		5
+#define SIM_URXBUF		6
+#define SIM_UTXBUF		7
+
+/* PxIN of each port; PxOUT, PxDIR, PxIFG, PxIES and PxIE follow. */
+static const uint16_t sim_portRegs[6] = { 0x0020, 0x0028, 0x0018, 0x001C, 0x0030, 0x0034 };
+
+/* The interrupt handlers of the library, if linked. */
+extern void TIMERA_IRQHandler( void ) __attribute__( ( weak ) );
+extern void instrument_TIMERA1_IRQ( void ) __attribute__( ( weak ) );
+extern void clock_NMI_IRQ( void ) __attribute__( ( weak ) );
+extern void Serial_UART0_IRQ( void ) __attribute__( ( weak ) );
+extern void Serial_UART0_TX_IRQ( void ) __attribute__( ( weak ) );
+extern void Serial_UART1_IRQ( void ) __attribute__( ( weak ) );
+extern void Serial_UART1_TX_IRQ( void ) __attribute__( ( weak ) );
+extern void SPI_USART1_RX_IRQ( void ) __attribute__( ( weak ) );
+extern void GPIO_PORT1_IRQ( void ) __attribute__( ( weak ) );
+extern void GPIO_PORT2_IRQ( void ) __attribute__( ( weak ) );
+
+volatile uint16_t sim_io[SIM_IO_SIZE / 2];
+
+static double sim_now;					/* Seconds since reset */
+static uint64_t sim_cycles;				/* CPU cycles since reset */
+static uint32_t sim_pendingCycles;		/* CPU cycles not yet converted to time */
+static uint16_t sim_sr;
+static uint16_t sim_stack[SIM_IRQ_DEPTH];	/* SR saved by the interrupts */
+static int sim_depth;
+
+/* Register write waiting to take effect, see sim_commit( ). */
+static int sim_storeAddr;
+static uint16_t sim_storeOld;
+
+static sim_handler_t sim_vectors[SIM_NUM_VECTORS];
+static uint16_t sim_requests;			/* Interrupts requested by sim_raise( ) */
+static uint32_t sim_irqCount[SIM_NUM_VECTORS];
+
+static uint32_t sim_xtFreq[2];
+static double sim_xtStartup[2];
+static double sim_xtEnabled[2];			/* Time the crystal was enabled */
+static double sim_dcoDrift;
+
+/* Clock frequencies, updated by sim_updateClocks( ). */
+static double sim_dco;
+static double sim_mclk;
+static double sim_smclk;
+static double sim_aclk;
+static double sim_timerClock;
+
+static double sim_timerPhase;			/* Fraction of the next timer count */
+static double sim_aclkPhase;			/* Fraction of the next ACLK period */
+
+static sim_usart_t sim_usarts[2];
+static sim_slave_t sim_slave;
+static uint8_t sim_pinInput[6];
+
+static void sim_fatal( const char* message );
+static void sim_count( uint32_t cycles );
+static void sim_sync( int dispatch );
+static void sim_commit( void );
+static void sim_onStore( int addr, uint16_t old );
+static void sim_onLoad( int addr );
+static void sim_advance( double end, int stop );
+static void sim_updateFaults( void );
+static void sim_updateClocks( void );
+static int sim_xtRunning( int xt );
+static uint32_t sim_timerDistance( void );
+static void sim_timerCount( uint32_t counts );
+static void sim_timerStep( uint32_t counts );
+static int sim_captureACLK( void );
+static void sim_capture( void );
+static int sim_pendingIrq( void );
+static int sim_readyIrq( void );
+static void sim_dispatch( void );
+static void sim_sleep( void );
+static double sim_usartCharTime( int n );
+static double sim_usartPeerTime( int n );
+static int sim_usartBits( int n );
+static void sim_usartReset( int n );
+static void sim_usartWrite( int n, uint8_t data );
+static void sim_usartStart( int n, uint8_t data );
+static void sim_usartShiftDone( int n );
+static void sim_usartReceive( int n );
+static void sim_updatePins( int port );
+
+void sim_reset( void )
+{
+	int i;
+
+	for( i = 0; i < SIM_IO_SIZE / 2; i++ )
+		sim_io[i] = 0;
+
+	/* Power-up values. */
+	IFG1 = OFIFG | UTXIFG0;
+	IFG2 = UTXIFG1;
+	U0CTL = SWRST;
+	U1CTL = SWRST;
+	U0TCTL = TXEPT;
+	U1TCTL = TXEPT;
+	DCOCTL = DCO1 | DCO0;
+	BCSCTL1 = XT2OFF | RSEL2;
+	BCSCTL2 = 0;
+
+	sim_now = 0;
+	sim_cycles = 0;
+	sim_pendingCycles = 0;
+	sim_sr = 0;
+	sim_depth = 0;
+	sim_storeAddr = -1;
+
+	for( i = 0; i < SIM_NUM_VECTORS; i++ )
+		sim_setVector( i * 2, NULL );
+	sim_requests = 0;
+	memset( sim_irqCount, 0, sizeof( sim_irqCount ) );
+
+	sim_xtFreq[SIM_XT1] = 32768;
+	sim_xtFreq[SIM_XT2] = 0;
+	sim_xtStartup[SIM_XT1] = 0;
+	sim_xtStartup[SIM_XT2] = 0;
+	sim_xtEnabled[SIM_XT1] = 0;
+	sim_xtEnabled[SIM_XT2] = 0;
+	sim_dcoDrift = 1.0;
+
+	sim_timerPhase = 0;
+	sim_aclkPhase = 0;
+
+	memset( sim_usarts, 0, sizeof( sim_usarts ) );
+	sim_usarts[0].rxNext = INFINITY;
+	sim_usarts[1].rxNext = INFINITY;
+	sim_slave = NULL;
+	memset( sim_pinInput, 0, sizeof( sim_pinInput ) );
+
+	sim_updateClocks( );
+}
+
+uint64_t sim_getCycles( void )
+{
+	return sim_cycles;
+}
+
+uint64_t sim_getTime( void )
+{
+	sim_sync( 0 );
+	return ( uint64_t )llround( sim_now * 1e9 );
+}
+
+void sim_run( uint32_t cycles )
+{
+	while( cycles )
+	{
+		uint32_t n = ( cycles > SIM_QUANTUM ) ? SIM_QUANTUM : cycles;
+
+		sim_count( n );
+		sim_sync( 1 );
+		cycles -= n;
+	}
+}
+
+void sim_runFor( uint32_t usec )
+{
+	double end;
+
+	sim_sync( 1 );
+	end = sim_now + usec * 1e-6;
+
+	while( sim_now < end )
+		sim_run( SIM_QUANTUM );
+}
+
+void sim_setCrystal( int xt, uint32_t freq, uint32_t startup_usec )
+{
+	sim_sync( 0 );
+
+	sim_xtFreq[xt] = freq;
+	sim_xtStartup[xt] = startup_usec * 1e-6;
+	sim_xtEnabled[xt] = sim_now;
+
+	sim_updateFaults( );
+	sim_updateClocks( );
+}
+
+void sim_setDCODrift( double factor )
+{
+	sim_sync( 0 );
+
+	sim_dcoDrift = factor;
+	sim_updateClocks( );
+}
+
+double sim_getDCOFrequency( void )
+{
+	static const double base[8] =
+	{
+		110e3, 180e3, 290e3, 470e3, 750e3, 1300e3, 2000e3, 3200e3
+	};
+	int rsel = BCSCTL1 & ( RSEL0 | RSEL1 | RSEL2 );
+	int dco = DCOCTL >> 5;
+	int mod = DCOCTL & 0x1F;
+	double freq = base[rsel] * pow( SIM_DCO_STEP, dco - 3 );
+
+	/* MOD mixes in the next tap for mod of 32 periods,
+	 * except on the highest tap. */
+	if( dco < 7 && mod )
+		freq = 32.0 / ( ( 32 - mod ) / freq + mod / ( freq * SIM_DCO_STEP ) );
+
+	return freq * sim_dcoDrift;
+}
+
+void sim_setVector( unsigned int vector, sim_handler_t handler )
+{
+	unsigned int irq = SIM_IRQ( vector );
+
+	if( irq >= SIM_NUM_VECTORS )
+		sim_fatal( "invalid vector" );
+
+	if( handler )
+	{
+		sim_vectors[irq] = handler;
+		return;
+	}
+
+	switch( vector )
+	{
+	case TIMERA0_VECTOR:	handler = TIMERA_IRQHandler; break;
+	case TIMERA1_VECTOR:	handler = instrument_TIMERA1_IRQ; break;
+	case NMI_VECTOR:		handler = clock_NMI_IRQ; break;
+	case USART0RX_VECTOR:	handler = Serial_UART0_IRQ; break;
+	case USART0TX_VECTOR:	handler = Serial_UART0_TX_IRQ; break;
+	case USART1TX_VECTOR:	handler = Serial_UART1_TX_IRQ; break;
+	case PORT1_VECTOR:		handler = GPIO_PORT1_IRQ; break;
+	case PORT2_VECTOR:		handler = GPIO_PORT2_IRQ; break;
+	case USART1RX_VECTOR:
+		handler = Serial_UART1_IRQ ? Serial_UART1_IRQ : SPI_USART1_RX_IRQ;
+		break;
+	default:
+		break;
+	}
+
+	sim_vectors[irq] = handler;
+}
+
+void sim_raise( unsigned int vector )
+{
+	if( SIM_IRQ( vector ) >= SIM_NUM_VECTORS )
+		sim_fatal( "invalid vector" );
+
+	sim_requests |= 1 << SIM_IRQ( vector );
+}
+
+uint32_t sim_getIrqCount( unsigned int vector )
+{
+	if( SIM_IRQ( vector ) >= SIM_NUM_VECTORS )
+		return 0;
+
+	return sim_irqCount[SIM_IRQ( vector )];
+}
+
+void sim_setPin( int port, int bit, int level )
+{
+	sim_sync( 0 );
+
+	if( level )
+		sim_pinInput[port - 1] |= ( 1 << bit );
+	else
+		sim_pinInput[port - 1] &= ~( 1 << bit );
+
+	sim_updatePins( port - 1 );
+}
+
+uint8_t sim_getPins( int port )
+{
+	sim_sync( 0 );
+	return SIM_SFRB( sim_portRegs[port - 1] );
+}
+
+void sim_uartSend( int usart, const uint8_t* data, uint16_t size )
+{
+	sim_usart_t* u = &sim_usarts[usart];
+
+	sim_sync( 0 );
+
+	while( size-- && u->rxCount < SIM_UART_RX_SIZE )
+	{
+		u->rx[( u->rxHead + u->rxCount ) % SIM_UART_RX_SIZE] = *data++;
+		u->rxCount++;
+	}
+
+	if( isinf( u->rxNext ) )
+		u->rxNext = sim_now + sim_usartPeerTime( usart );
+}
+
+uint16_t sim_uartReceive( int usart, uint8_t* data, uint16_t size )
+{
+	sim_usart_t* u = &sim_usarts[usart];
+
+	sim_sync( 0 );
+
+	if( size > u->logSize )
+		size = u->logSize;
+
+	memcpy( data, u->log, size );
+	memmove( u->log, u->log + size, u->logSize - size );
+	u->logSize -= size;
+
+	return size;
+}
+
+uint16_t sim_uartGetErrors( int usart )
+{
+	sim_sync( 0 );
+	return sim_usarts[usart].errors;
+}
+
+void sim_uartSetBaud( int usart, uint32_t baud )
+{
+	sim_usarts[usart].baud = baud;
+}
+
+void sim_setSlave( sim_slave_t slave )
+{
+	sim_slave = slave;
+}
+
+void sim_load( const volatile void* addr, unsigned int size, int is_volatile )
+{
+	uintptr_t offset = ( uintptr_t )addr - ( uintptr_t )sim_io;
+
+	if( offset < SIM_IO_SIZE )
+	{
+		sim_count( SIM_CYCLES_REGISTER );
+		sim_sync( 1 );
+		sim_onLoad( offset );
+		return;
+	}
+
+	sim_count( SIM_CYCLES_MEMORY * ( ( size + 1 ) / 2 ) );
+	if( is_volatile || sim_pendingCycles >= SIM_QUANTUM )
+		sim_sync( 1 );
+}
+
+void sim_store( const volatile void* addr, unsigned int size, int is_volatile )
+{
+	uintptr_t offset = ( uintptr_t )addr - ( uintptr_t )sim_io;
+
+	if( offset < SIM_IO_SIZE )
+	{
+		sim_count( SIM_CYCLES_REGISTER );
+
+		/* No interrupt between the read and the write of a register,
+		 * see sim.h. The write takes effect at the next access. */
+		sim_sync( 0 );
+		sim_storeAddr = offset;
+		sim_storeOld = ( size == 1 ) ? SIM_SFRB( offset ) : SIM_SFRW( offset );
+		return;
+	}
+
+	( void )is_volatile;
+	sim_count( SIM_CYCLES_MEMORY * ( ( size + 1 ) / 2 ) );
+}
+
+void sim_call( void )
+{
+	sim_count( SIM_CYCLES_CALL / 2 );
+	if( sim_pendingCycles >= SIM_QUANTUM )
+		sim_sync( 1 );
+}
+
+unsigned int __get_SR_register( void )
+{
+	sim_count( 1 );
+	sim_sync( 1 );
+	return sim_sr;
+}
+
+void __bis_SR_register( unsigned int bits )
+{
+	sim_count( 2 );
+	sim_sync( 1 );
+
+	sim_sr |= bits;
+	sim_updateClocks( );
+
+	if( sim_sr & CPUOFF )
+		sim_sleep( );
+	else
+		sim_sync( 1 );
+}
+
+void __bic_SR_register( unsigned int bits )
+{
+	sim_count( 2 );
+	sim_sync( 1 );
+
+	sim_sr &= ~bits;
+	sim_updateClocks( );
+}
+
+void __bis_SR_register_on_exit( unsigned int bits )
+{
+	if( sim_depth == 0 )
+		sim_fatal( "__bis_SR_register_on_exit( ) outside of an interrupt" );
+
+	sim_count( 3 );
+	sim_stack[sim_depth - 1] |= bits;
+}
+
+void __bic_SR_register_on_exit( unsigned int bits )
+{
+	if( sim_depth == 0 )
+		sim_fatal( "__bic_SR_register_on_exit( ) outside of an interrupt" );
+
+	sim_count( 3 );
+	sim_stack[sim_depth - 1] &= ~bits;
+}
+
+void __enable_interrupt( void )
+{
+	sim_count( 2 );
+	sim_sr |= GIE;
+	sim_sync( 1 );
+}
+
+void __disable_interrupt( void )
+{
+	sim_count( 2 );
+	sim_sync( 1 );
+	sim_sr &= ~GIE;
+}
+
+void __nop( void )
+{
+	sim_count( 1 );
+	sim_sync( 1 );
+}
+
+void __delay_cycles( unsigned long cycles )
+{
+	sim_run( cycles );
+}
+
+static void sim_fatal( const char* message )
+{
+	fprintf( stderr, "sim: %s, at %.6f s\n", message, sim_now );
+	abort( );
+}
+
+/**
+ * Charges CPU cycles, converted to time by the next sim_sync( ).
+ */
+static void sim_count( uint32_t cycles )
+{
+	sim_cycles += cycles;
+	sim_pendingCycles += cycles;
+}
+
+/**
+ * Brings the peripherals up to the CPU: applies the pending register
+ * write, advances the time by the pending cycles and, if dispatch is
+ * set, services the pending interrupts.
+ */
+static void sim_sync( int dispatch )
+{
+	sim_commit( );
+
+	if( sim_pendingCycles )
+	{
+		double end;
+
+		if( sim_mclk <= 0 )
+			sim_fatal( "MCLK stopped" );
+
+		end = sim_now + sim_pendingCycles / sim_mclk;
+		sim_pendingCycles = 0;
+		sim_advance( end, 0 );
+	}
+
+	if( dispatch )
+		sim_dispatch( );
+}
+
+/**
+ * Applies the side effects of the last register write, which the
+ * CPU has completed by now.
+ */
+static void sim_commit( void )
+{
+	int addr = sim_storeAddr;
+
+	if( addr < 0 )
+		return;
+
+	sim_storeAddr = -1;
+	sim_onStore( addr, sim_storeOld );
+}
+
+static void sim_onStore( int addr, uint16_t old )
+{
+	int n;
+
+	switch( addr )
+	{
+	case 0x0160:	/* TACTL */
+		if( TACTL & TACLR )
+		{
+			TAR = 0;
+			TACTL &= ~TACLR;
+			sim_timerPhase = 0;
+		}
+		sim_updateClocks( );
+		return;
+
+	case 0x0170:	/* TAR */
+		sim_timerPhase = 0;
+		return;
+
+	case 0x012E:	/* TAIV is read-only */
+		TAIV = old;
+		return;
+
+	case 0x0057:	/* BCSCTL1 */
+		if( ( old & XT2OFF ) && !( BCSCTL1 & XT2OFF ) )
+			sim_xtEnabled[SIM_XT2] = sim_now;
+		/* fall through */
+	case 0x0056:	/* DCOCTL */
+	case 0x0058:	/* BCSCTL2 */
+		sim_updateFaults( );
+		sim_updateClocks( );
+		return;
+
+	default:
+		break;
+	}
+
+	for( n = 0; n < 2; n++ )
+	{
+		uint16_t base = sim_usartRegs[n].base;
+
+		if( addr < base || addr > base + SIM_UTXBUF )
+			continue;
+
+		switch( addr - base )
+		{
+		case SIM_UCTL:
+			if( SIM_SFRB( addr ) & SWRST )
+				sim_usartReset( n );
+			break;
+
+		case SIM_UTCTL:
+			/* TXEPT is read-only. */
+			if( sim_usarts[n].shifting )
+				SIM_SFRB( addr ) &= ~TXEPT;
+			else
+				SIM_SFRB( addr ) |= TXEPT;
+			break;
+
+		case SIM_URXBUF:	/* Read-only */
+			SIM_SFRB( addr ) = old;
+			break;
+
+		case SIM_UTXBUF:
+			sim_usartWrite( n, SIM_SFRB( addr ) );
+			break;
+
+		default:
+			break;
+		}
+
+		/* The clock select or the dividers may have changed. */
+		sim_updateClocks( );
+		return;
+	}
+
+	for( n = 0; n < 6; n++ )
+	{
+		uint16_t in = sim_portRegs[n];
+
+		if( addr == in )
+			SIM_SFRB( addr ) = old;		/* PxIN is read-only */
+		else if( addr != in + 1 && addr != in + 2 )
+			continue;
+
+		sim_updatePins( n );
+		return;
+	}
+}
+
+static void sim_onLoad( int addr )
+{
+	int n;
+
+	if( addr == 0x012E )
+	{
+		/* TAIV: the highest priority enabled flag, which the read clears. */
+		uint16_t taiv = TAIV_NONE;
+
+		if( ( TACCTL1 & ( CCIE | CCIFG ) ) == ( CCIE | CCIFG ) )
+		{
+			taiv = TAIV_TACCR1;
+			TACCTL1 &= ~CCIFG;
+		}
+		else if( ( TACCTL2 & ( CCIE | CCIFG ) ) == ( CCIE | CCIFG ) )
+		{
+			taiv = TAIV_TACCR2;
+			TACCTL2 &= ~CCIFG;
+		}
+		else if( ( TACTL & ( TAIE | TAIFG ) ) == ( TAIE | TAIFG ) )
+		{
+			taiv = TAIV_TAIFG;
+			TACTL &= ~TAIFG;
+		}
+
+		TAIV = taiv;
+		return;
+	}
+
+	for( n = 0; n < 2; n++ )
+	{
+		if( addr == sim_usartRegs[n].base + SIM_URXBUF )
+		{
+			/* Reading RXBUF clears URXIFG and the receive errors. */
+			SIM_SFRB( sim_usartRegs[n].ifg ) &= ~sim_usartRegs[n].rx;
+			SIM_SFRB( sim_usartRegs[n].base + SIM_URCTL ) &= ~( FE | PE | OE | BRK | RXERR );
+		}
+	}
+}
+
+/**
+ * Advances the peripherals to time end, event by event. If stop is set,
+ * returns early once an interrupt can be serviced.
+ */
+static void sim_advance( double end, int stop )
+{
+	while( sim_now < end )
+	{
+		double next = end;
+		double t, step;
+		int event = SIM_EVENT_NONE;
+		uint32_t counts = 0;
+		int n;
+
+		sim_updateFaults( );
+		sim_updateClocks( );
+
+		if( sim_timerClock > 0 && ( counts = sim_timerDistance( ) ) != 0 )
+		{
+			t = sim_now + ( counts - sim_timerPhase ) / sim_timerClock;
+			if( t <= next )
+			{
+				next = t;
+				event = SIM_EVENT_TIMER;
+			}
+		}
+
+		if( sim_aclk > 0 && sim_captureACLK( ) )
+		{
+			t = sim_now + ( 1.0 - sim_aclkPhase ) / sim_aclk;
+			if( t < next )
+			{
+				next = t;
+				event = SIM_EVENT_ACLK;
+			}
+		}
+
+		for( n = 0; n < 2; n++ )
+		{
+			if( sim_usarts[n].shifting && sim_usarts[n].shiftEnd < next )
+			{
+				next = sim_usarts[n].shiftEnd;
+				event = SIM_EVENT_SHIFT0 + n;
+			}
+			if( sim_usarts[n].rxNext < next )
+			{
+				next = sim_usarts[n].rxNext;
+				event = SIM_EVENT_RX0 + n;
+			}
+		}
+
+		for( n = 0; n < 2; n++ )
+		{
+			t = sim_xtEnabled[n] + sim_xtStartup[n];
+			if( sim_xtFreq[n] && t > sim_now && t < next )
+			{
+				next = t;
+				event = SIM_EVENT_CRYSTAL;
+			}
+		}
+
+		if( next < sim_now )
+			next = sim_now;
+		step = next - sim_now;
+
+		/* Count the timer up to the event. Only a timer event may
+		 * complete the counts to the next compare or overflow. */
+		if( counts )
+		{
+			if( event == SIM_EVENT_TIMER )
+			{
+				sim_timerPhase = 0;
+				sim_timerCount( counts );
+			}
+			else
+			{
+				double c = sim_timerPhase + step * sim_timerClock;
+				uint32_t whole = ( uint32_t )c;
+
+				if( whole >= counts )
+				{
+					whole = counts - 1;
+					c = whole + 0.999999;
+				}
+				sim_timerPhase = c - whole;
+				sim_timerCount( whole );
+			}
+		}
+
+		if( event == SIM_EVENT_ACLK )
+			sim_aclkPhase = 0;
+		else if( sim_aclk > 0 )
+		{
+			sim_aclkPhase += step * sim_aclk;
+			sim_aclkPhase -= floor( sim_aclkPhase );
+		}
+
+		sim_now = ( event == SIM_EVENT_NONE ) ? end : next;
+
+		switch( event )
+		{
+		case SIM_EVENT_ACLK:
+			sim_capture( );
+			break;
+		case SIM_EVENT_SHIFT0:
+		case SIM_EVENT_SHIFT1:
+			sim_usartShiftDone( event - SIM_EVENT_SHIFT0 );
+			break;
+		case SIM_EVENT_RX0:
+		case SIM_EVENT_RX1:
+			sim_usartReceive( event - SIM_EVENT_RX0 );
+			break;
+		default:
+			break;
+		}
+
+		if( stop && sim_readyIrq( ) >= 0 )
+			break;
+	}
+
+	sim_updateFaults( );
+	sim_updateClocks( );
+}
+
+/**
+ * Sets OFIFG while an enabled crystal is not running. A fault of LFXT1
+ * is only detected in high frequency mode.
+ */
+static void sim_updateFaults( void )
+{
+	int fault = 0;
+
+	if( ( BCSCTL1 & XTS ) && !sim_xtRunning( SIM_XT1 ) )
+		fault = 1;
+	if( !( BCSCTL1 & XT2OFF ) && !sim_xtRunning( SIM_XT2 ) )
+		fault = 1;
+
+	if( fault )
+		IFG1 |= OFIFG;
+}
+
+/**
+ * Decodes the clock frequencies from the registers, and reschedules
+ * the characters being shifted if their clock changed.
+ */
+static void sim_updateClocks( void )
+{
+	double xt1 = sim_xtRunning( SIM_XT1 ) ? sim_xtFreq[SIM_XT1] : 0;
+	double xt2 = sim_xtRunning( SIM_XT2 ) ? sim_xtFreq[SIM_XT2] : 0;
+	uint8_t bcsctl2 = BCSCTL2;
+	int n;
+
+	sim_dco = sim_getDCOFrequency( );
+
+	/* MCLK falls back to the DCO while a crystal fault is flagged. */
+	switch( bcsctl2 & SELM_3 )
+	{
+	case SELM_2: sim_mclk = xt2; break;
+	case SELM_3: sim_mclk = xt1; break;
+	default: sim_mclk = sim_dco; break;
+	}
+	if( ( bcsctl2 & SELM1 ) && ( IFG1 & OFIFG ) )
+		sim_mclk = sim_dco;
+	sim_mclk /= 1 << ( ( bcsctl2 >> 4 ) & 3 );
+
+	sim_smclk = ( bcsctl2 & SELS ) ? xt2 : sim_dco;
+	sim_smclk /= 1 << ( ( bcsctl2 >> 1 ) & 3 );
+	if( sim_sr & SCG1 )
+		sim_smclk = 0;
+
+	sim_aclk = xt1 / ( 1 << ( ( BCSCTL1 >> 4 ) & 3 ) );
+
+	switch( TACTL & TASSEL_3 )
+	{
+	case TASSEL_1: sim_timerClock = sim_aclk; break;
+	case TASSEL_2: sim_timerClock = sim_smclk; break;
+	default: sim_timerClock = 0; break;
+	}
+	sim_timerClock /= 1 << ( ( TACTL >> 6 ) & 3 );
+	if( ( TACTL & MC_3 ) == MC_0 )
+		sim_timerClock = 0;
+
+	for( n = 0; n < 2; n++ )
+	{
+		sim_usart_t* u = &sim_usarts[n];
+		double time = sim_usartCharTime( n );
+
+		/* A character shifted at two rates is garbled. */
+		if( u->shifting && time != u->shiftTime )
+		{
+			double left = isinf( u->shiftTime ) ? 1.0 : ( u->shiftEnd - sim_now ) / u->shiftTime;
+
+			u->shiftEnd = sim_now + left * time;
+			u->shiftTime = time;
+			u->corrupt = 1;
+		}
+
+		if( u->rxCount && isinf( u->rxNext ) )
+			u->rxNext = sim_now + sim_usartPeerTime( n );
+	}
+}
+
+static int sim_xtRunning( int xt )
+{
+	if( xt == SIM_XT1 && ( sim_sr & OSCOFF ) )
+		return 0;
+	if( xt == SIM_XT2 && ( BCSCTL1 & XT2OFF ) )
+		return 0;
+
+	return sim_xtFreq[xt] && sim_now >= sim_xtEnabled[xt] + sim_xtStartup[xt];
+}
+
+/**
+ * Returns the number of timer counts to the next compare match or
+ * overflow, 0 if the timer is stopped.
+ */
+static uint32_t sim_timerDistance( void )
+{
+	const volatile uint16_t* cctl[3] = { &TACCTL0, &TACCTL1, &TACCTL2 };
+	const volatile uint16_t* ccr[3] = { &TACCR0, &TACCR1, &TACCR2 };
+	uint16_t tar = TAR;
+	uint32_t best, d;
+	int i;
+
+	if( ( TACTL & MC_3 ) == MC_2 )
+	{
+		best = 0x10000 - tar;
+		for( i = 0; i < 3; i++ )
+		{
+			if( *cctl[i] & CAP )
+				continue;
+
+			d = ( uint16_t )( *ccr[i] - tar );
+			if( d == 0 )
+				d = 0x10000;
+			if( d < best )
+				best = d;
+		}
+		return best;
+	}
+
+	/* Up mode; up/down mode is not modelled and counts up too. */
+	if( TACCR0 == 0 )
+		return 0;
+	if( tar >= TACCR0 )
+		return 1;
+
+	best = TACCR0 - tar;
+	for( i = 1; i < 3; i++ )
+	{
+		d = ( uint16_t )( *ccr[i] - tar );
+		if( !( *cctl[i] & CAP ) && *ccr[i] > tar && d < best )
+			best = d;
+	}
+	return best;
+}
+
+/**
+ * Counts the timer, setting the flags of the compares and overflows.
+ */
+static void sim_timerCount( uint32_t counts )
+{
+	while( counts )
+	{
+		uint32_t d = sim_timerDistance( );
+
+		if( d == 0 )
+			return;
+		if( d > counts )
+			d = counts;
+
+		sim_timerStep( d );
+		counts -= d;
+	}
+}
+
+/**
+ * Counts the timer by no more than the distance to the next event.
+ */
+static void sim_timerStep( uint32_t counts )
+{
+	volatile uint16_t* cctl[3] = { &TACCTL0, &TACCTL1, &TACCTL2 };
+	const volatile uint16_t* ccr[3] = { &TACCR0, &TACCR1, &TACCR2 };
+	uint16_t tar = TAR;
+	int i;
+
+	if( ( TACTL & MC_3 ) != MC_2 && tar >= TACCR0 )
+	{
+		/* Up mode rolls over to zero after TACCR0. */
+		if( tar == TACCR0 )
+			TACTL |= TAIFG;
+		TAR = 0;
+	}
+	else
+	{
+		if( tar + counts >= 0x10000 )
+			TACTL |= TAIFG;
+		TAR = tar + counts;
+	}
+
+	for( i = 0; i < 3; i++ )
+	{
+		if( !( *cctl[i] & CAP ) && *ccr[i] == TAR )
+			*cctl[i] |= CCIFG;
+	}
+}
+
+/**
+ * Returns 1 if CCR2 captures TAR on the rising edges of ACLK (CCI2B).
+ */
+static int sim_captureACLK( void )
+{
+	return ( TACCTL2 & CAP ) && ( TACCTL2 & CCIS_3 ) == CCIS_1 && ( TACCTL2 & CM_3 ) != CM_0 &&
+		sim_timerClock > 0;
+}
+
+static void sim_capture( void )
+{
+	if( TACCTL2 & CCIFG )
+		TACCTL2 |= COV;
+
+	TACCR2 = TAR;
+	TACCTL2 |= CCIFG;
+}
+
+/**
+ * Returns the vector table index of the highest priority interrupt
+ * requested, enabled or not by GIE, -1 if none.
+ */
+static int sim_pendingIrq( void )
+{
+	int irq;
+
+	for( irq = SIM_NUM_VECTORS - 1; irq > 0; irq-- )
+	{
+		int pending = 0;
+
+		switch( irq * 2 )
+		{
+		case NMI_VECTOR:
+			pending = ( IE1 & OFIE ) && ( IFG1 & OFIFG );
+			break;
+		case USART0RX_VECTOR:
+			pending = IE1 & IFG1 & URXIE0;
+			break;
+		case USART0TX_VECTOR:
+			pending = IE1 & IFG1 & UTXIE0;
+			break;
+		case TIMERA0_VECTOR:
+			pending = ( TACCTL0 & ( CCIE | CCIFG ) ) == ( CCIE | CCIFG );
+			break;
+		case TIMERA1_VECTOR:
+			pending = ( TACTL & ( TAIE | TAIFG ) ) == ( TAIE | TAIFG ) ||
+				( TACCTL1 & ( CCIE | CCIFG ) ) == ( CCIE | CCIFG ) ||
+				( TACCTL2 & ( CCIE | CCIFG ) ) == ( CCIE | CCIFG );
+			break;
+		case PORT1_VECTOR:
+			pending = P1IE & P1IFG;
+			break;
+		case USART1RX_VECTOR:
+			pending = IE2 & IFG2 & URXIE1;
+			break;
+		case USART1TX_VECTOR:
+			pending = IE2 & IFG2 & UTXIE1;
+			break;
+		case PORT2_VECTOR:
+			pending = P2IE & P2IFG;
+			break;
+		default:
+			break;
+		}
+
+		if( pending || ( sim_requests & ( 1 << irq ) ) )
+			return irq;
+	}
+
+	return -1;
+}
+
+/**
+ * Returns the vector table index of the interrupt to service now, -1 if none.
+ */
+static int sim_readyIrq( void )
+{
+	int irq = sim_pendingIrq( );
+
+	if( irq < 0 || ( irq != SIM_IRQ( NMI_VECTOR ) && !( sim_sr & GIE ) ) )
+		return -1;
+
+	return irq;
+}
+
+/**
+ * Services the interrupts that can be serviced, by priority.
+ */
+static void sim_dispatch( void )
+{
+	int irq;
+
+	while( ( irq = sim_readyIrq( ) ) >= 0 )
+	{
+		sim_handler_t handler = sim_vectors[irq];
+
+		if( !handler )
+			sim_fatal( "interrupt without a handler" );
+		if( sim_depth == SIM_IRQ_DEPTH )
+			sim_fatal( "interrupts nested too deep" );
+
+		/* Flags reset when the interrupt is accepted. */
+		sim_requests &= ~( 1 << irq );
+		switch( irq * 2 )
+		{
+		case NMI_VECTOR: IE1 &= ~OFIE; break;
+		case USART0RX_VECTOR: IFG1 &= ~URXIFG0; break;
+		case USART0TX_VECTOR: IFG1 &= ~UTXIFG0; break;
+		case TIMERA0_VECTOR: TACCTL0 &= ~CCIFG; break;
+		case USART1RX_VECTOR: IFG2 &= ~URXIFG1; break;
+		case USART1TX_VECTOR: IFG2 &= ~UTXIFG1; break;
+		default: break;
+		}
+
+		/* Push SR and clear it, except SCG0. */
+		sim_stack[sim_depth++] = sim_sr;
+		sim_sr &= SCG0;
+		sim_updateClocks( );
+		sim_irqCount[irq]++;
+		sim_count( SIM_CYCLES_INTERRUPT );
+
+		handler( );
+
+		sim_commit( );
+		sim_sr = sim_stack[--sim_depth];
+		sim_updateClocks( );
+
+		/* Bring time up to date before the next one. */
+		sim_sync( 0 );
+	}
+}
+
+/**
+ * Sleeps in low power mode until an interrupt clears CPUOFF.
+ */
+static void sim_sleep( void )
+{
+	double limit = sim_now + SIM_SLEEP_LIMIT_SEC;
+
+	while( sim_sr & CPUOFF )
+	{
+		if( sim_readyIrq( ) < 0 )
+		{
+			if( !( sim_sr & GIE ) )
+				sim_fatal( "low power mode with interrupts disabled" );
+
+			sim_advance( limit, 1 );
+			if( sim_readyIrq( ) < 0 )
+				sim_fatal( "low power mode without wake-up" );
+		}
+
+		sim_dispatch( );
+	}
+}
+
+static int sim_usartBits( int n )
+{
+	uint8_t uctl = SIM_SFRB( sim_usartRegs[n].base + SIM_UCTL );
+
+	if( uctl & SYNC )
+		return 8;
+
+	return 1 + ( ( uctl & CHAR ) ? 8 : 7 ) + ( ( uctl & PENA ) ? 1 : 0 ) + ( ( uctl & SPB ) ? 2 : 1 );
+}
+
+/**
+ * Returns the time to shift a character at the current settings,
+ * infinite if the USART has no clock.
+ */
+static double sim_usartCharTime( int n )
+{
+	uint16_t base = sim_usartRegs[n].base;
+	uint16_t ubr = SIM_SFRB( base + SIM_UBR0 ) | ( SIM_SFRB( base + SIM_UBR1 ) << 8 );
+	uint8_t umctl = SIM_SFRB( base + SIM_UMCTL );
+	int bits = sim_usartBits( n );
+	double brclk, cycles = 0;
+	int i;
+
+	switch( SIM_SFRB( base + SIM_UTCTL ) & ( SSEL1 | SSEL0 ) )
+	{
+	case SSEL0: brclk = sim_aclk; break;
+	case SSEL1:
+	case SSEL1 | SSEL0: brclk = sim_smclk; break;
+	default: brclk = 0; break;	/* UCLKI */
+	}
+
+	if( SIM_SFRB( base + SIM_UCTL ) & SYNC )
+	{
+		if( ubr < 2 )
+			ubr = 2;
+		cycles = bits * ubr;
+	}
+	else
+	{
+		if( ubr < 3 )
+			return INFINITY;
+
+		/* Each bit of UMCTL stretches a bit time by one cycle. */
+		for( i = 0; i < bits; i++ )
+			cycles += ubr + ( ( umctl >> ( i & 7 ) ) & 1 );
+	}
+
+	if( brclk <= 0 )
+		return INFINITY;
+
+	return cycles / brclk;
+}
+
+/**
+ * Returns the time the peer takes to send a character: at its baud
+ * rate if set, otherwise at the rate of the USART.
+ */
+static double sim_usartPeerTime( int n )
+{
+	if( sim_usarts[n].baud )
+		return sim_usartBits( n ) / ( double )sim_usarts[n].baud;
+
+	return sim_usartCharTime( n );
+}
+
+static void sim_usartReset( int n )
+{
+	sim_usart_t* u = &sim_usarts[n];
+	uint16_t base = sim_usartRegs[n].base;
+
+	/* The characters in the shift register and in TXBUF are lost. */
+	u->errors += u->shifting + u->buffered;
+	u->shifting = 0;
+	u->buffered = 0;
+
+	SIM_SFRB( sim_usartRegs[n].ie ) &= ~( sim_usartRegs[n].rx | sim_usartRegs[n].tx );
+	SIM_SFRB( sim_usartRegs[n].ifg ) &= ~sim_usartRegs[n].rx;
+	SIM_SFRB( sim_usartRegs[n].ifg ) |= sim_usartRegs[n].tx;
+	SIM_SFRB( base + SIM_UTCTL ) |= TXEPT;
+	SIM_SFRB( base + SIM_URCTL ) &= URXEIE | URXWIE;
+}
+
+/**
+ * A character written to TXBUF.
+ */
+static void sim_usartWrite( int n, uint8_t data )
+{
+	sim_usart_t* u = &sim_usarts[n];
+	uint16_t base = sim_usartRegs[n].base;
+	uint8_t uctl = SIM_SFRB( base + SIM_UCTL );
+	uint8_t enable = ( uctl & SYNC ) ? sim_usartRegs[n].rx : sim_usartRegs[n].tx;
+
+	if( ( uctl & SWRST ) || !( SIM_SFRB( sim_usartRegs[n].me ) & enable ) )
+		return;
+
+	if( !u->shifting )
+	{
+		sim_usartStart( n, data );
+		return;
+	}
+
+	/* Overwriting a character that is still in TXBUF loses it. */
+	if( u->buffered )
+		u->errors++;
+
+	u->txData = data;
+	u->buffered = 1;
+	SIM_SFRB( sim_usartRegs[n].ifg ) &= ~sim_usartRegs[n].tx;
+}
+
+/**
+ * Moves a character to the shift register, which frees TXBUF.
+ */
+static void sim_usartStart( int n, uint8_t data )
+{
+	sim_usart_t* u = &sim_usarts[n];
+
+	u->shifting = 1;
+	u->corrupt = 0;
+	u->shiftData = data;
+	u->shiftTime = sim_usartCharTime( n );
+	u->shiftEnd = sim_now + u->shiftTime;
+
+	SIM_SFRB( sim_usartRegs[n].ifg ) |= sim_usartRegs[n].tx;
+	SIM_SFRB( sim_usartRegs[n].base + SIM_UTCTL ) &= ~TXEPT;
+}
+
+static void sim_usartShiftDone( int n )
+{
+	sim_usart_t* u = &sim_usarts[n];
+	uint16_t base = sim_usartRegs[n].base;
+
+	/* The peer samples at its own baud rate. */
+	if( u->baud && !( SIM_SFRB( base + SIM_UCTL ) & SYNC ) )
+	{
+		double baud = sim_usartBits( n ) / u->shiftTime;
+
+		if( fabs( baud - u->baud ) > u->baud * SIM_UART_BAUD_TOLERANCE )
+			u->corrupt = 1;
+	}
+
+	if( u->corrupt )
+		u->errors++;
+	if( u->logSize < SIM_UART_LOG_SIZE )
+		u->log[u->logSize++] = u->shiftData;
+
+	/* SPI receives a character for every character sent. */
+	if( SIM_SFRB( base + SIM_UCTL ) & SYNC )
+	{
+		uint8_t in = sim_slave ? sim_slave( u->shiftData ) : u->shiftData;
+
+		if( SIM_SFRB( sim_usartRegs[n].ifg ) & sim_usartRegs[n].rx )
+			SIM_SFRB( base + SIM_URCTL ) |= OE;
+
+		SIM_SFRB( base + SIM_URXBUF ) = in;
+		SIM_SFRB( sim_usartRegs[n].ifg ) |= sim_usartRegs[n].rx;
+	}
+
+	u->shifting = 0;
+	if( u->buffered )
+	{
+		u->buffered = 0;
+		sim_usartStart( n, u->txData );
+	}
+	else
+		SIM_SFRB( base + SIM_UTCTL ) |= TXEPT;
+}
+
+/**
+ * A character from sim_uartSend( ) arrives.
+ */
+static void sim_usartReceive( int n )
+{
+	sim_usart_t* u = &sim_usarts[n];
+	uint16_t base = sim_usartRegs[n].base;
+	uint8_t data = u->rx[u->rxHead];
+	double time = sim_usartCharTime( n );
+
+	u->rxHead = ( u->rxHead + 1 ) % SIM_UART_RX_SIZE;
+	u->rxCount--;
+	u->rxNext = u->rxCount ? sim_now + sim_usartPeerTime( n ) : INFINITY;
+
+	if( ( SIM_SFRB( base + SIM_UCTL ) & SWRST ) || !( SIM_SFRB( sim_usartRegs[n].me ) & sim_usartRegs[n].rx ) )
+		return;
+
+	if( SIM_SFRB( sim_usartRegs[n].ifg ) & sim_usartRegs[n].rx )
+		SIM_SFRB( base + SIM_URCTL ) |= OE | RXERR;
+
+	/* Sampled at the wrong rate. */
+	if( u->baud && fabs( sim_usartBits( n ) / time - u->baud ) > u->baud * SIM_UART_BAUD_TOLERANCE )
+		SIM_SFRB( base + SIM_URCTL ) |= FE | RXERR;
+
+	SIM_SFRB( base + SIM_URXBUF ) = data;
+	SIM_SFRB( sim_usartRegs[n].ifg ) |= sim_usartRegs[n].rx;
+}
+
+/**
+ * Updates PxIN from the outputs and the inputs, and flags the edges
+ * of P1 and P2.
+ */
+static void sim_updatePins( int port )
+{
+	uint16_t in = sim_portRegs[port];
+	uint8_t dir = SIM_SFRB( in + 2 );
+	uint8_t old = SIM_SFRB( in );
+	uint8_t level = ( SIM_SFRB( in + 1 ) & dir ) | ( sim_pinInput[port] & ~dir );
+
+	SIM_SFRB( in ) = level;
+
+	if( port < 2 )
+	{
+		uint8_t ies = SIM_SFRB( in + 4 );
+		uint8_t edges = ( ~old & level & ~ies ) | ( old & ~level & ies );
+
+		SIM_SFRB( in + 3 ) |= edges;
+	}
+}
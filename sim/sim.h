@@ -0,0 +1,210 @@
+/**
+ * @Brief MSP430F149 simulator for host tests and benchmarks.
+ *
+ * The library is compiled for the host against sim/msp430.h, whose
+ * registers live in a simulated register file. The simulator models the
+ * peripherals behind the registers: the Basic Clock module and its
+ * crystals, TimerA, USART0/1 in UART and SPI mode, and the P1-P6 pins.
+ * Interrupts are dispatched to the library's handlers by priority, as
+ * the CPU would, with the status register saved and restored around
+ * them.
+ *
+ * Time is driven by a virtual cycle counter. The library sources are
+ * compiled with the instrumentation of the thread sanitizer, which calls
+ * a hook before every memory access and around every function; the
+ * simulator provides the hooks instead of the sanitizer runtime, see
+ * sim_hooks.c. Each hook charges the cycles of the access to the counter,
+ * so that code advances time roughly as on the MSP430, and updates the
+ * peripherals. Register accesses are recognized by their address: writes
+ * take effect on the next access and reads see the flags up to date.
+ * Interrupts are taken before reads and at function boundaries, never
+ * between the read and the write of a read-modify-write, which is a
+ * single instruction on the MSP430.
+ *
+ * The cycle counts are an estimate, see SIM_CYCLES_XXX. They are exact
+ * for the intrinsics and consistent between runs, which makes them
+ * suitable for comparisons and regression thresholds, but they are not
+ * the cycle counts of the MSP430 code.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Cycles charged for a memory access. */
+#define SIM_CYCLES_MEMORY		2
+
+/** Cycles charged for a peripheral register access. */
+#define SIM_CYCLES_REGISTER		3
+
+/** Cycles charged for a function call and its return. */
+#define SIM_CYCLES_CALL			8
+
+/** Cycles charged for accepting an interrupt and returning from it. */
+#define SIM_CYCLES_INTERRUPT	11
+
+/** Longest time the CPU may sleep without being woken up, in seconds. */
+#define SIM_SLEEP_LIMIT_SEC		1000
+
+/** Crystals. */
+enum
+{
+	SIM_XT1,		/**< LFXT1, clocks ACLK. */
+	SIM_XT2			/**< XT2. */
+};
+
+/** Interrupt handler. */
+typedef void ( *sim_handler_t )( void );
+
+/** SPI slave: returns the byte shifted in for the byte shifted out. */
+typedef uint8_t ( *sim_slave_t )( uint8_t mosi );
+
+/**
+ * Resets the simulated MCU: registers to their power-up values, time and
+ * cycle counter to 0, interrupts disabled. The crystals and the DCO
+ * model are reset to a 32768 Hz LFXT1, no XT2, and no drift.
+ * The state of the library is not reset.
+ */
+void sim_reset( void );
+
+/**
+ * Returns the number of CPU cycles executed since @ref sim_reset( ).
+ * The cycles in low power mode are not counted.
+ */
+uint64_t sim_getCycles( void );
+
+/**
+ * Returns the time since @ref sim_reset( ), in nanoseconds.
+ */
+uint64_t sim_getTime( void );
+
+/**
+ * Executes cycles of main program code: time advances and pending
+ * interrupts are serviced, as if the main program was computing.
+ * @param[in] cycles	CPU cycles.
+ */
+void sim_run( uint32_t cycles );
+
+/**
+ * Executes main program code for a time, see @ref sim_run( ).
+ * @param[in] usec		Time in microseconds.
+ */
+void sim_runFor( uint32_t usec );
+
+/**
+ * Configures a crystal. Can be called at any time, e.g. to make a
+ * running crystal fail.
+ * @param[in] xt			@ref SIM_XT1 or @ref SIM_XT2.
+ * @param[in] freq			Frequency in Hz, 0 if missing or failed.
+ * @param[in] startup_usec	Time from enabling the crystal until it is stable.
+ */
+void sim_setCrystal( int xt, uint32_t freq, uint32_t startup_usec );
+
+/**
+ * Scales the DCO frequency, e.g. by temperature or supply drift.
+ * @param[in] factor	1.0 for the nominal frequencies.
+ */
+void sim_setDCODrift( double factor );
+
+/**
+ * Returns the current frequency of the DCO, in Hz.
+ */
+double sim_getDCOFrequency( void );
+
+/**
+ * Replaces the handler of an interrupt vector. The handlers of the
+ * library are installed by default.
+ * @param[in] vector	One of XXX_VECTOR.
+ * @param[in] handler	The handler, or NULL to restore the default.
+ */
+void sim_setVector( unsigned int vector, sim_handler_t handler );
+
+/**
+ * Requests an interrupt, regardless of the flags and enable bits of its
+ * source. The request is serviced once interrupts are enabled, by
+ * priority, and cleared when serviced.
+ * @param[in] vector	One of XXX_VECTOR.
+ */
+void sim_raise( unsigned int vector );
+
+/**
+ * Returns the number of times an interrupt has been serviced since
+ * @ref sim_reset( ).
+ * @param[in] vector	One of XXX_VECTOR.
+ */
+uint32_t sim_getIrqCount( unsigned int vector );
+
+/**
+ * Drives an input pin. An edge sets the interrupt flag of P1 and P2
+ * pins, according to PxIES.
+ * @param[in] port		GPIO port, 1 to 6.
+ * @param[in] bit		GPIO port bit, 0 to 7.
+ * @param[in] level		0 or 1.
+ */
+void sim_setPin( int port, int bit, int level );
+
+/**
+ * Returns the levels of the pins of a port: PxOUT for the outputs and
+ * the driven level for the inputs.
+ * @param[in] port		GPIO port, 1 to 6.
+ */
+uint8_t sim_getPins( int port );
+
+/**
+ * Sends characters to a USART in UART mode, one character time apart.
+ * @param[in] usart		0 or 1.
+ * @param[in] data		The characters.
+ * @param[in] size		Number of characters.
+ */
+void sim_uartSend( int usart, const uint8_t* data, uint16_t size );
+
+/**
+ * Returns the characters transmitted by a USART, in UART or SPI mode,
+ * and removes them.
+ * @param[in] usart		0 or 1.
+ * @param[out] data		Stores the characters.
+ * @param[in] size		Size of data.
+ * @return Number of characters stored.
+ */
+uint16_t sim_uartReceive( int usart, uint8_t* data, uint16_t size );
+
+/**
+ * Returns the number of characters that were corrupted while being
+ * transmitted: lost to a reset of the USART, shifted while its baud
+ * rate changed, or sent at the wrong rate, see @ref sim_uartSetBaud( ).
+ * @param[in] usart		0 or 1.
+ */
+uint16_t sim_uartGetErrors( int usart );
+
+/**
+ * Sets the baud rate of the peer of a USART in UART mode. The peer
+ * sends at this rate, and counts the characters it receives at a rate
+ * off by more than 3% as errors, see @ref sim_uartGetErrors( ).
+ * @param[in] usart		0 or 1.
+ * @param[in] baud		Baud rate, 0 to follow the USART.
+ */
+void sim_uartSetBaud( int usart, uint32_t baud );
+
+/**
+ * Sets the SPI slave on USART1. By default, SOMI is looped back to SIMO.
+ * @param[in] slave		The slave, or NULL for the loopback.
+ */
+void sim_setSlave( sim_slave_t slave );
+
+/* Used by the hooks of sim_hooks.c. */
+void sim_load( const volatile void* addr, unsigned int size, int is_volatile );
+void sim_store( const volatile void* addr, unsigned int size, int is_volatile );
+void sim_call( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @Brief Instrumentation hooks of the simulator.
+ *
+ * The library is compiled with -fsanitize=thread and
+ * --param=tsan-distinguish-volatile=1, which make the compiler call
+ * the __tsan_XXX functions below before every memory access and
+ * around every function. They are defined here instead of by the
+ * sanitizer runtime, which is not linked, and pass the accesses
+ * on to the simulator.
+ *
+ * @Author iliaspat
+ *
+ */
+#include "sim.h"
+
+#include <string.h>
+
+#define SIM_HOOKS( size )																\
+	void __tsan_read##size( void* addr ) { sim_load( addr, size, 0 ); }					\
+	void __tsan_write##size( void* addr ) { sim_store( addr, size, 0 ); }				\
+	void __tsan_unaligned_read##size( void* addr ) { sim_load( addr, size, 0 ); }		\
+	void __tsan_unaligned_write##size( void* addr ) { sim_store( addr, size, 0 ); }		\
+	void __tsan_volatile_read##size( void* addr ) { sim_load( addr, size, 1 ); }		\
+	void __tsan_volatile_write##size( void* addr ) { sim_store( addr, size, 1 ); }		\
+	void __tsan_unaligned_volatile_read##size( void* addr ) { sim_load( addr, size, 1 ); }	\
+	void __tsan_unaligned_volatile_write##size( void* addr ) { sim_store( addr, size, 1 ); }
+
+SIM_HOOKS( 1 )
+SIM_HOOKS( 2 )
+SIM_HOOKS( 4 )
+SIM_HOOKS( 8 )
+SIM_HOOKS( 16 )
+
+void __tsan_init( void )
+{
+}
+
+void __tsan_func_entry( void* pc )
+{
+	( void )pc;
+	sim_call( );
+}
+
+void __tsan_func_exit( void )
+{
+	sim_call( );
+}
+
+void __tsan_read_range( void* addr, unsigned long size )
+{
+	sim_load( addr, size, 0 );
+}
+
+void __tsan_write_range( void* addr, unsigned long size )
+{
+	sim_store( addr, size, 0 );
+}
+
+void* __tsan_memcpy( void* dst, const void* src, unsigned long size )
+{
+	sim_load( src, size, 0 );
+	sim_store( dst, size, 0 );
+	return memcpy( dst, src, size );
+}
+
+void* __tsan_memmove( void* dst, const void* src, unsigned long size )
+{
+	sim_load( src, size, 0 );
+	sim_store( dst, size, 0 );
+	return memmove( dst, src, size );
+}
+
+void* __tsan_memset( void* dst, int c, unsigned long size )
+{
+	sim_store( dst, size, 0 );
+	return memset( dst, c, size );
+}
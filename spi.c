@@ -1,12 +1,69 @@
 #include "spi.h"
 #include "types.h"
 #include "clock.h"
+#include "usart.h"
+#include "critical.h"
+#include "serial.h"
+#include "gpio.h"
+#include "instrument.h"
 
 #include <msp430.h>
 
-#define SPI_CLK_SRC		SMCLK
 #define DUMMY			( 0xFF )
 
+/* Queues the next byte in the Tx buf as soon as it is free, while
+ * the previous byte is still being shifted, and then receives the
+ * previous byte. This keeps the shift register busy between bytes.
+ */
+#define SPI_TRANSFER_STEP( in, out )			\
+	do {										\
+		while( ( IFG2 & UTXIFG1 ) == 0 );		\
+		TXBUF1 = ( out );						\
+		while( ( IFG2 & URXIFG1 ) == 0 );		\
+		( in ) = RXBUF1;						\
+	} while( 0 )
+
+/* Register profile currently programmed, see SPI_beginTransaction( ). */
+static SPI_device_t SPI_active;
+static uint8_t SPI_activeValid;
+
+/* Clock requested in SPI_init( ) or SPI_configClock( ). */
+static uint32_t SPI_clockRate;
+static uint16_t SPI_clockSource;
+static clock_listener_t SPI_clockListener;
+
+static void SPI_calcDivider( uint32_t spi_clk, uint32_t clock_rate, SPI_device_t* device );
+static void SPI_setDivider( void );
+static void SPI_retime( void* user );
+static void SPI_prepareRetime( void* user );
+
+#if SPI_ASYNC_ENABLE
+#if SERIAL_NUM_PORTS > 1
+#error "SPI_ASYNC_ENABLE requires SERIAL_NUM_PORTS 1: both use the USART1 interrupts"
+#endif
+
+#define SPI_QUEUE_MASK	( SPI_ASYNC_QUEUE_SIZE - 1 )
+
+/**
+ * Interrupt driven transfer.
+ */
+typedef struct
+{
+	uint8_t* in;
+	const uint8_t* out;
+	uint16_t size;
+	SPI_Callback_t callback;
+	void* user;
+} SPI_transfer_t;
+
+static SPI_transfer_t SPI_queue[SPI_ASYNC_QUEUE_SIZE];
+static volatile uint8_t SPI_queueHead;
+static volatile uint8_t SPI_queueCount;
+static uint16_t SPI_index;		/* Byte of the transfer at SPI_queueHead */
+
+static void SPI_startTransfer( void );
+#endif
+
 void SPI_init( uint8_t spi_port, uint8_t mode, uint32_t clock_rate, uint16_t clock_source )
 {
 	/* Currently only port 1 is supported. */
@@ -36,19 +93,17 @@ void SPI_init( uint8_t spi_port, uint8_t mode, uint32_t clock_rate, uint16_t clo
 		UTCTL1 |= SSEL0;	/* defaults to ACLK */
 
 	/* Set the baudrate dividers and modulation */
-	uint32_t spi_clk = clock_get( clock_source );
-	unsigned int N_div;
-	N_div = spi_clk / clock_rate;
-
-	float N_div_f;
-	N_div_f = (float)spi_clk / (float)clock_rate;
-
-	UBR01 = ( unsigned char )( N_div & 0x00FF );
-	UBR11 = ( unsigned char )( ( N_div & 0xFF00 ) >> 8 );
-	UMCTL1 = ( unsigned char )( ( ( N_div_f - ( int )( N_div_f ) ) ) * 8.0f ) << 1; // Set BRS
+	SPI_clockRate = clock_rate;
+	SPI_clockSource = clock_source;
+	SPI_setDivider( );
 
     /* Remove reset */
     UCTL1 &= ~SWRST;
+
+	/* Recompute the dividers when the clock frequency changes. */
+	SPI_clockListener.callback = SPI_retime;
+	SPI_clockListener.prepare = SPI_prepareRetime;
+	clock_subscribe( &SPI_clockListener );
 }
 
 void SPI_uninit( uint8_t spi_port )
@@ -59,6 +114,8 @@ void SPI_uninit( uint8_t spi_port )
     UCTL1 = SWRST;
     UTCTL1 = SYNC;
     IE2 = 0;
+
+	clock_unsubscribe( &SPI_clockListener );
 }
 
 void SPI_configClock( uint8_t spi_port, uint32_t clock_rate, uint16_t clock_source )
@@ -77,21 +134,92 @@ void SPI_configClock( uint8_t spi_port, uint32_t clock_rate, uint16_t clock_sour
 		UTCTL1 |= SSEL0;	/* defaults to ACLK */
 
 	/* Set the baudrate dividers and modulation */
-	uint32_t spi_clk = clock_get( SPI_CLK_SRC );
-	unsigned int N_div;
-	N_div = spi_clk / clock_rate;
-
-	float N_div_f;
-	N_div_f = (float)spi_clk / (float)clock_rate;
-
-	UBR01 = ( unsigned char )( N_div & 0x00FF );
-	UBR11 = ( unsigned char )( ( N_div & 0xFF00 ) >> 8 );
-	UMCTL1 = ( unsigned char )( ( ( N_div_f - ( int )( N_div_f ) ) ) * 8.0f ) << 1; // Set BRS
+	SPI_clockRate = clock_rate;
+	SPI_clockSource = clock_source;
+	SPI_setDivider( );
 
     /* Remove reset */
     UCTL1 &= ~SWRST;
 }
 
+void SPI_deviceInit( SPI_device_t* device, int cs_pin, uint8_t mode, uint32_t clock_rate, uint16_t clock_source )
+{
+	device->cs_pin = cs_pin;
+	device->cs_out = GPIO_regOUT( mapPinToPort( cs_pin ) );	/* NULL for no chip select */
+	device->cs_mask = ( 1 << mapPinToBit( cs_pin ) );
+	device->clock_rate = clock_rate;
+
+	/* 3-pin SPI mode | CPOL/CPHA conf | Clock Source */
+	device->utctl = STC | mode;
+	if( clock_source == SMCLK )
+		device->utctl |= SSEL1;
+	else
+		device->utctl |= SSEL0;	/* defaults to ACLK */
+
+	SPI_calcDivider( clock_get( clock_source ), clock_rate, device );
+	device->version = clock_getVersion( );
+
+	/* Deselect the device. */
+	if( device->cs_out )
+	{
+		digitalWrite( cs_pin, HIGH );
+		pinMode( cs_pin, OUTPUT );
+	}
+}
+
+void SPI_beginTransaction( uint8_t spi_port, SPI_device_t* device )
+{
+	/* Currently only port 1 is supported. */
+	( void )spi_port;
+
+	/* Recompute the dividers if a clock has changed since they were computed. */
+	if( device->version != clock_getVersion( ) )
+	{
+		uint16_t clock_source = ( device->utctl & SSEL1 ) ? SMCLK : ACLK;
+		SPI_calcDivider( clock_get( clock_source ), device->clock_rate, device );
+		device->version = clock_getVersion( );
+	}
+
+	/* Reconfigure only if the device needs a different profile. */
+	if( !SPI_activeValid ||
+		device->utctl != SPI_active.utctl ||
+		device->ubr0 != SPI_active.ubr0 ||
+		device->ubr1 != SPI_active.ubr1 ||
+		device->umctl != SPI_active.umctl )
+	{
+		/* Keep in reset while configuring. */
+		UCTL1 |= SWRST;
+
+		UTCTL1 = device->utctl;
+		UBR01 = device->ubr0;
+		UBR11 = device->ubr1;
+		UMCTL1 = device->umctl;
+
+		/* Remove reset */
+		UCTL1 &= ~SWRST;
+
+		SPI_active = *device;
+		SPI_activeValid = 1;
+	}
+
+	/* Select the device. */
+	if( device->cs_out )
+		*device->cs_out &= ~device->cs_mask;
+}
+
+void SPI_endTransaction( uint8_t spi_port, const SPI_device_t* device )
+{
+	/* Currently only port 1 is supported. */
+	( void )spi_port;
+
+	/* Wait for the last byte to be shifted out. */
+	while( ( UTCTL1 & TXEPT ) == 0 );
+
+	/* Deselect the device. */
+	if( device->cs_out )
+		*device->cs_out |= device->cs_mask;
+}
+
 uint8_t SPI_transferByte( uint8_t spi_port, uint8_t byte )
 {
 	/* Currently only port 1 is supported. */
@@ -117,14 +245,33 @@ void SPI_receiveFrame( uint8_t spi_port, uint8_t* buffer, uint16_t size )
 	/* Currently only port 1 is supported. */
 	( void )spi_port;
 
-    while( size )
-    {
-    	/* Write dummy byte to clock data in. */
-    	TXBUF1 = DUMMY;
-        while ( ( IFG2 & URXIFG1 ) == 0 );
-        *buffer++ = RXBUF1;
-        size--;
-    }
+	if( size == 0 )
+		return;
+
+	/* Write dummy bytes to clock data in. The first goes
+	 * straight to the shift register. */
+	while( ( IFG2 & UTXIFG1 ) == 0 );
+	TXBUF1 = DUMMY;
+	size--;
+
+	while( size >= 4 )
+	{
+		SPI_TRANSFER_STEP( *buffer++, DUMMY );
+		SPI_TRANSFER_STEP( *buffer++, DUMMY );
+		SPI_TRANSFER_STEP( *buffer++, DUMMY );
+		SPI_TRANSFER_STEP( *buffer++, DUMMY );
+		size -= 4;
+	}
+
+	while( size )
+	{
+		SPI_TRANSFER_STEP( *buffer++, DUMMY );
+		size--;
+	}
+
+	/* Receive the last byte. */
+	while( ( IFG2 & URXIFG1 ) == 0 );
+	*buffer = RXBUF1;
 }
 
 void SPI_transmitFrame( uint8_t spi_port, const uint8_t* buffer, uint16_t size)
@@ -132,6 +279,19 @@ void SPI_transmitFrame( uint8_t spi_port, const uint8_t* buffer, uint16_t size)
 	/* Currently only port 1 is supported. */
 	( void )spi_port;
 
+	while( size >= 4 )
+	{
+		while( ( IFG2 & UTXIFG1 ) == 0 );
+		TXBUF1 = *buffer++;
+		while( ( IFG2 & UTXIFG1 ) == 0 );
+		TXBUF1 = *buffer++;
+		while( ( IFG2 & UTXIFG1 ) == 0 );
+		TXBUF1 = *buffer++;
+		while( ( IFG2 & UTXIFG1 ) == 0 );
+		TXBUF1 = *buffer++;
+		size -= 4;
+	}
+
     while( size )
     {
     	while( ( IFG2 & UTXIFG1 ) == 0 );
@@ -139,8 +299,10 @@ void SPI_transmitFrame( uint8_t spi_port, const uint8_t* buffer, uint16_t size)
         size--;
     }
 
-    /* clear the rx flag. Not reset automatically
-     * as no char read from RX buf. */
+    /* Wait for the last byte to be shifted out, then clear
+     * the rx flag. Not reset automatically as no char read
+     * from RX buf. */
+    while( ( UTCTL1 & TXEPT ) == 0 );
     IFG2 &= ~URXIFG1;
 }
 
@@ -149,12 +311,195 @@ void SPI_transferFrame( uint8_t spi_port, uint8_t* in_buffer, const uint8_t* out
 	/* Currently only port 1 is supported. */
 	( void )spi_port;
 
-    while( size )
-    {
-    	while( ( IFG2 & UTXIFG1) == 0 );
-        TXBUF1 = *out_buffer++;
-        while( ( IFG2 & URXIFG1 ) == 0 );
-        *in_buffer++ = RXBUF1;
-        size--;
-    }
+	if( size == 0 )
+		return;
+
+	/* The first byte goes straight to the shift register. */
+	while( ( IFG2 & UTXIFG1 ) == 0 );
+	TXBUF1 = *out_buffer++;
+	size--;
+
+	while( size >= 4 )
+	{
+		SPI_TRANSFER_STEP( *in_buffer++, *out_buffer++ );
+		SPI_TRANSFER_STEP( *in_buffer++, *out_buffer++ );
+		SPI_TRANSFER_STEP( *in_buffer++, *out_buffer++ );
+		SPI_TRANSFER_STEP( *in_buffer++, *out_buffer++ );
+		size -= 4;
+	}
+
+	while( size )
+	{
+		SPI_TRANSFER_STEP( *in_buffer++, *out_buffer++ );
+		size--;
+	}
+
+	/* Receive the last byte. */
+	while( ( IFG2 & URXIFG1 ) == 0 );
+	*in_buffer = RXBUF1;
+}
+
+static void SPI_calcDivider( uint32_t spi_clk, uint32_t clock_rate, SPI_device_t* device )
+{
+	usart_divider_t div;
+	usart_calcDivider( spi_clk, clock_rate, &div );
+
+	/* Modulation is not used in SPI mode, and the
+	 * divider must be at least 2. */
+	if( div.ubr1 == 0 && div.ubr0 < 2 )
+		div.ubr0 = 2;
+
+	device->ubr0 = div.ubr0;
+	device->ubr1 = div.ubr1;
+	device->umctl = 0;
+}
+
+/**
+ * Programs the dividers for the clock requested in SPI_init( ).
+ * Must be called in soft reset.
+ */
+static void SPI_setDivider( void )
+{
+	SPI_calcDivider( clock_get( SPI_clockSource ), SPI_clockRate, &SPI_active );
+	UBR01 = SPI_active.ubr0;
+	UBR11 = SPI_active.ubr1;
+	UMCTL1 = SPI_active.umctl;
+	SPI_activeValid = 0;
+}
+
+/**
+ * Clock listener: holds a clock change until the byte being shifted
+ * has been sent. An asynchronous transfer is paused, and resumed in
+ * SPI_retime( ).
+ */
+static void SPI_prepareRetime( void* user )
+{
+	( void )user;
+
+	IE2 &= ~URXIE1;
+	while( ( UTCTL1 & TXEPT ) == 0 );
+}
+
+/**
+ * Clock listener: reprograms the dividers for the new clock frequency.
+ * Device descriptors are updated by SPI_beginTransaction( ).
+ */
+static void SPI_retime( void* user )
+{
+	( void )user;
+	critical_state_t state = critical_enter( );
+
+	/* Soft reset clears the interrupt enable bits, and the flag of
+	 * a byte received; restore them, or an asynchronous transfer
+	 * would never complete. */
+	uint8_t ie = IE2 & ( URXIE1 | UTXIE1 );
+	uint8_t ifg = IFG2 & URXIFG1;
+
+#if SPI_ASYNC_ENABLE
+	/* Resume, if paused by SPI_prepareRetime( ). */
+	if( SPI_queueCount )
+		ie |= URXIE1;
+#endif
+
+	UCTL1 |= SWRST;
+	SPI_setDivider( );
+	UCTL1 &= ~SWRST;
+	IFG2 |= ifg;
+	IE2 |= ie;
+
+	critical_exit( state );
+}
+
+#if SPI_ASYNC_ENABLE
+int SPI_transferFrameAsync( uint8_t spi_port, uint8_t* in_buffer, const uint8_t* out_buffer, uint16_t size,
+		SPI_Callback_t callback, void* user )
+{
+	/* Currently only port 1 is supported. */
+	( void )spi_port;
+
+	if( size == 0 )
+		return 0;
+
+	critical_state_t state = critical_enter( );
+
+	if( SPI_queueCount == SPI_ASYNC_QUEUE_SIZE )
+	{
+		critical_exit( state );
+		return 0;
+	}
+
+	SPI_transfer_t* t = &SPI_queue[( SPI_queueHead + SPI_queueCount ) & SPI_QUEUE_MASK];
+	t->in = in_buffer;
+	t->out = out_buffer;
+	t->size = size;
+	t->callback = callback;
+	t->user = user;
+
+	/* Start now if the bus is idle. Otherwise the
+	 * interrupt starts it when the previous completes. */
+	if( SPI_queueCount++ == 0 )
+		SPI_startTransfer( );
+
+	critical_exit( state );
+
+	return 1;
+}
+
+uint8_t SPI_isBusy( uint8_t spi_port )
+{
+	/* Currently only port 1 is supported. */
+	( void )spi_port;
+
+	return SPI_queueCount != 0;
+}
+
+static void SPI_startTransfer( void )
+{
+	SPI_transfer_t* t = &SPI_queue[SPI_queueHead];
+
+	SPI_index = 0;
+
+	/* Discard any stale byte, then clock out the first. */
+	IFG2 &= ~URXIFG1;
+	IE2 |= URXIE1;
+	TXBUF1 = t->out ? t->out[0] : DUMMY;
+}
+
+__attribute__( ( __interrupt__( USART1RX_VECTOR ) ) )
+void SPI_USART1_RX_IRQ( void )
+{
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_UART1_RX );
+
+	SPI_transfer_t* t = &SPI_queue[SPI_queueHead];
+	uint8_t byte = RXBUF1;
+
+	if( t->in )
+		t->in[SPI_index] = byte;
+
+	/* One byte is in flight at a time: send the next
+	 * byte once the previous one has been received. */
+	if( ++SPI_index < t->size )
+	{
+		TXBUF1 = t->out ? t->out[SPI_index] : DUMMY;
+		INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_UART1_RX );
+		return;
+	}
+
+	/* Transfer complete. The callback may queue a new transfer
+	 * into the freed slot, so read it first. */
+	SPI_Callback_t callback = t->callback;
+	void* user = t->user;
+
+	SPI_queueHead = ( SPI_queueHead + 1 ) & SPI_QUEUE_MASK;
+	if( --SPI_queueCount )
+		SPI_startTransfer( );
+	else
+		IE2 &= ~URXIE1;
+
+	if( callback )
+		callback( user );
+
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_UART1_RX );
+	__bic_SR_register_on_exit( LPM3_bits );
 }
+#endif
@@ -17,6 +17,40 @@ extern "C" {
 #define SPI_MODE2    ( CKPL )         	/**< CPOL = 1, CPHA = 0 */
 #define SPI_MODE3    ( CKPL | CKPH )	/**< CPOL = 1, CPHA = 1 */
 
+/**
+ * Enables interrupt driven transfers, see @ref SPI_transferFrameAsync( ).
+ * They use the USART1 receive interrupt, which is also used by serial
+ * port 1, so @ref SERIAL_NUM_PORTS must be set to 1.
+ */
+#ifndef SPI_ASYNC_ENABLE
+#define SPI_ASYNC_ENABLE		0
+#endif
+
+/** Number of interrupt driven transfers that can be pending. Must be a power of two. */
+#define SPI_ASYNC_QUEUE_SIZE	4
+
+/**
+ * SPI device descriptor. Holds the chip select pin and the register
+ * profile of a device on the bus, precomputed by @ref SPI_deviceInit( ).
+ */
+typedef struct
+{
+	int cs_pin;			/**< Chip select pin as specified in @ref pin_map.h. Active low. */
+
+	// private - do not use.
+	volatile unsigned char* cs_out;
+	uint8_t cs_mask;
+	uint32_t clock_rate;
+	uint16_t version;
+	uint8_t utctl;
+	uint8_t ubr0;
+	uint8_t ubr1;
+	uint8_t umctl;
+} SPI_device_t;
+
+/** Called from the interrupt handler when an interrupt driven transfer completes. */
+typedef void ( *SPI_Callback_t )( void* user );
+
 /**
  * Initializes the SPI hardware, in master mode.
  * @param[in] spi_port		Specifies the MCU USART port to operate on.
@@ -34,6 +68,43 @@ void SPI_init( uint8_t spi_port, uint8_t mode, uint32_t clock_rate, uint16_t clo
  */
 void SPI_uninit( uint8_t spi_port );
 
+/**
+ * Changes the SPI clock rate and source.
+ * @param[in] spi_port		Specifies the SPI port to operate on.
+ * @param[in] clock_rate 	Clock rate in Hz.
+ * @param[in] clock_source 	Source of SPI clock, one of ACLK or SMCLK.
+ */
+void SPI_configClock( uint8_t spi_port, uint32_t clock_rate, uint16_t clock_source );
+
+/**
+ * Initializes a device descriptor and deselects the device.
+ * The clock dividers are computed here, and again by
+ * @ref SPI_beginTransaction( ) after a clock change.
+ * @param[out] device		The device descriptor.
+ * @param[in] cs_pin		Chip select pin as specified in @ref pin_map.h. A pin of
+ * 							an invalid port, e.g. 0, leaves the chip select to the caller.
+ * @param[in] mode 			Specifies the SPI CLK polarity and phase.
+ * @param[in] clock_rate 	Clock rate in Hz.
+ * @param[in] clock_source 	Source of SPI clock, one of ACLK or SMCLK.
+ */
+void SPI_deviceInit( SPI_device_t* device, int cs_pin, uint8_t mode, uint32_t clock_rate, uint16_t clock_source );
+
+/**
+ * Selects a device for a transaction. The SPI hardware is
+ * reconfigured only if the device's profile differs from the
+ * profile currently programmed.
+ * @param[in] spi_port	Specifies the SPI port to operate on.
+ * @param[in] device	The device descriptor.
+ */
+void SPI_beginTransaction( uint8_t spi_port, SPI_device_t* device );
+
+/**
+ * Waits for the last byte to be sent and deselects the device.
+ * @param[in] spi_port	Specifies the SPI port to operate on.
+ * @param[in] device	The device descriptor.
+ */
+void SPI_endTransaction( uint8_t spi_port, const SPI_device_t* device );
+
 /**
  * Sends and receives a single byte.
  * @param[in] spi_port	Specifies the SPI port to operate on.
@@ -44,10 +115,14 @@ uint8_t SPI_transferByte( uint8_t spi_port, uint8_t data );
 
 /**
  * Sends and receives a frame of specified size.
+ * The next byte is queued while the current byte is shifted, so
+ * that there is no gap between bytes.
  * @param[in] spi_port		Specifies the SPI port to operate on.
  * @param [in] size 		Number of bytes to transfer.
  * @param [out] in_buffer 	Stores received data.
  * @param [in] src 			Stores data to be transmitted.
+ * @attention Each byte must be read before the next one is received,
+ * so interrupts that take longer than one byte time cause overruns.
  */
 void SPI_transferFrame( uint8_t spi_port, uint8_t* in_buffer, const uint8_t* out_buffer, uint16_t size );
 
@@ -67,6 +142,32 @@ void SPI_receiveFrame( uint8_t spi_port, uint8_t* buffer, uint16_t size );
  */
 void SPI_transmitFrame( uint8_t spi_port, const uint8_t* buffer, uint16_t size );
 
+#if SPI_ASYNC_ENABLE
+/**
+ * Queues a frame to be sent and received in the background, driven by
+ * the SPI receive interrupt. Transfers are performed in the order they
+ * are queued. The CPU is woken up from low power mode when each transfer
+ * completes.
+ * @param[in] spi_port		Specifies the SPI port to operate on.
+ * @param [out] in_buffer 	Stores received data. Can be NULL to discard it.
+ * @param [in] out_buffer 	Stores data to be transmitted. Can be NULL to send dummy bytes.
+ * @param [in] size 		Number of bytes to transfer.
+ * @param [in] callback		Called when the transfer completes. Can be NULL.
+ * @param [in] user			A user provided variable that is passed in the callback function.
+ * @return	1 if the transfer was queued, 0 if the queue is full or size is 0.
+ * @attention The buffers must remain valid until the transfer completes.
+ * The blocking transfer functions must not be used while a transfer is pending.
+ */
+int SPI_transferFrameAsync( uint8_t spi_port, uint8_t* in_buffer, const uint8_t* out_buffer, uint16_t size,
+		SPI_Callback_t callback, void* user );
+
+/**
+ * Tests if interrupt driven transfers are pending.
+ * @param[in] spi_port	Specifies the SPI port to operate on.
+ * @return	1 if a transfer is pending, 0 otherwise.
+ */
+uint8_t SPI_isBusy( uint8_t spi_port );
+#endif
 
 #ifdef __cplusplus
 }
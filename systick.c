@@ -27,6 +27,8 @@ int systick_init( int tick_interval_ms, SystickCallback_t callback )
 
 static void systick_handler( void* user )
 {
+	( void )user;
+
 	_system_ticks++;
 
 	if( _systick_callback )
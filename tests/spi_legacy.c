@@ -0,0 +1,34 @@
+/*
+ * The SPI frame loops of spi.c before the transmit buffer was kept
+ * loaded: each byte is written only after the previous one has been
+ * received. Kept for comparison in test_spi.c.
+ */
+#include "spi_legacy.h"
+
+#include <msp430.h>
+
+#define DUMMY			( 0xFF )
+
+void spi_legacy_receiveFrame( uint8_t* buffer, uint16_t size )
+{
+	while( size )
+	{
+		/* Write dummy byte to clock data in. */
+		TXBUF1 = DUMMY;
+		while( ( IFG2 & URXIFG1 ) == 0 );
+		*buffer++ = RXBUF1;
+		size--;
+	}
+}
+
+void spi_legacy_transferFrame( uint8_t* in_buffer, const uint8_t* out_buffer, uint16_t size )
+{
+	while( size )
+	{
+		while( ( IFG2 & UTXIFG1 ) == 0 );
+		TXBUF1 = *out_buffer++;
+		while( ( IFG2 & URXIFG1 ) == 0 );
+		*in_buffer++ = RXBUF1;
+		size--;
+	}
+}
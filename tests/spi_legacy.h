@@ -0,0 +1,19 @@
+/**
+ * @Brief The SPI frame loops of spi.c before they kept the transmit
+ * buffer loaded, for comparison with the current ones.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef SPI_LEGACY_H_
+#define SPI_LEGACY_H_
+
+#include "types.h"
+
+/** The former @ref SPI_receiveFrame( ), on port 1. */
+void spi_legacy_receiveFrame( uint8_t* buffer, uint16_t size );
+
+/** The former @ref SPI_transferFrame( ), on port 1. */
+void spi_legacy_transferFrame( uint8_t* in_buffer, const uint8_t* out_buffer, uint16_t size );
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * @Brief Minimal test harness for the host tests.
+ *
+ * A test is a function that checks its expectations with TEST_ASSERT( )
+ * and friends. TEST_RUN( ) resets the simulator, runs the test and
+ * reports it; main( ) returns TEST_RESULT( ), which is non-zero if any
+ * expectation failed.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef TEST_H_
+#define TEST_H_
+
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_failures;
+static int test_failed;
+
+/** Checks a condition, and reports it if false. The test continues. */
+#define TEST_ASSERT( cond )															\
+	do {																			\
+		if( !( cond ) )																\
+		{																			\
+			printf( "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond );	\
+			test_failed = 1;														\
+		}																			\
+	} while( 0 )
+
+/** Checks that two integers are equal, and reports both if not. */
+#define TEST_EQUAL( actual, expected )												\
+	do {																			\
+		long long _test_a = ( long long )( actual );								\
+		long long _test_e = ( long long )( expected );								\
+		if( _test_a != _test_e )													\
+		{																			\
+			printf( "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__,		\
+				#actual, _test_a, _test_e );										\
+			test_failed = 1;														\
+		}																			\
+	} while( 0 )
+
+/** Checks that an integer is within [low, high], and reports it if not. */
+#define TEST_RANGE( actual, low, high )												\
+	do {																			\
+		long long _test_a = ( long long )( actual );								\
+		if( _test_a < ( long long )( low ) || _test_a > ( long long )( high ) )		\
+		{																			\
+			printf( "%s:%d: %s is %lld, expected %lld to %lld\n", __FILE__,			\
+				__LINE__, #actual, _test_a, ( long long )( low ),					\
+				( long long )( high ) );											\
+			test_failed = 1;														\
+		}																			\
+	} while( 0 )
+
+/** Resets the simulator and runs a test function. */
+#define TEST_RUN( test )															\
+	do {																			\
+		test_failed = 0;															\
+		sim_reset( );																\
+		test( );																	\
+		printf( "%s %s\n", test_failed ? "FAIL" : "ok  ", #test );				\
+		test_failures += test_failed;												\
+	} while( 0 )
+
+/** Exit status of the test program. */
+#define TEST_RESULT( )	( test_failures ? EXIT_FAILURE : EXIT_SUCCESS )
+
+#endif
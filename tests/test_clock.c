@@ -0,0 +1,233 @@
+/*
+ * Checks the DCO calibration of clock.c against the simulated TimerA
+ * and basic clock module: a drifting DCO is tuned to the target, and
+ * a dead ACLK crystal fails the calibration instead of hanging it.
+ * Also checks the crystal timeout and fault handling of clock_poll( )
+ * and the NMI, also during a transmission, and that a performance level
+ * cancels a pending switch.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "serial.h"
+#include <msp430.h>
+
+#include "test.h"
+
+#include <string.h>
+
+#define TEST_TARGET		2000000
+
+static void test_calibrate( void )
+{
+	static const double drifts[] = { 0.85, 1.0, 1.15 };
+	unsigned int i;
+
+	for( i = 0; i < sizeof( drifts ) / sizeof( drifts[0] ); i++ )
+	{
+		uint32_t freq;
+
+		sim_reset( );
+		sim_setDCODrift( drifts[i] );
+		clock_init( 32768, 0, DCO_FREQ_2000KHz );
+
+		freq = clock_calibrateDCO( TEST_TARGET );
+
+		/* Within 1% of the target, and of the frequency reached. */
+		TEST_RANGE( freq, TEST_TARGET * 99 / 100, TEST_TARGET * 101 / 100 );
+		TEST_RANGE( sim_getDCOFrequency( ), TEST_TARGET * 99 / 100, TEST_TARGET * 101 / 100 );
+		TEST_RANGE( freq, sim_getDCOFrequency( ) * 0.99, sim_getDCOFrequency( ) * 1.01 );
+		TEST_EQUAL( clock_get( SMCLK ), freq );
+
+		/* TimerA is given back. */
+		TEST_EQUAL( TACTL, 0 );
+		TEST_EQUAL( TACCTL2, 0 );
+	}
+}
+
+static void test_deadCrystal( void )
+{
+	uint8_t dcoctl, bcsctl1;
+	uint64_t start;
+
+	/* The oscillator fault is flagged in high frequency mode. */
+	sim_setCrystal( SIM_XT1, 0, 0 );
+	clock_init( 4000000, 0, DCO_FREQ_2000KHz );
+	dcoctl = DCOCTL;
+	bcsctl1 = BCSCTL1;
+
+	TEST_EQUAL( clock_calibrateDCO( TEST_TARGET ), 0 );
+	TEST_EQUAL( DCOCTL, dcoctl );
+	TEST_EQUAL( BCSCTL1, bcsctl1 );
+
+	/* No fault is flagged in low frequency mode: ACLK just stops. */
+	sim_reset( );
+	sim_setCrystal( SIM_XT1, 0, 0 );
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	dcoctl = DCOCTL;
+	bcsctl1 = BCSCTL1;
+	start = sim_getTime( );
+
+	TEST_EQUAL( clock_calibrateDCO( TEST_TARGET ), 0 );
+	TEST_EQUAL( DCOCTL, dcoctl );
+	TEST_EQUAL( BCSCTL1, bcsctl1 );
+	TEST_EQUAL( clock_get( SMCLK ), DCO_FREQ_2000KHz );
+	TEST_ASSERT( sim_getTime( ) - start < 100000000 );
+}
+
+/** Polls every interval msec until the crystal is no longer pending. */
+static int test_poll( uint32_t interval )
+{
+	int polls = 0;
+
+	do
+	{
+		sim_runFor( interval * 1000 );
+		polls++;
+	} while( clock_poll( ) == CLOCK_CRYSTAL_PENDING && polls < 1000 );
+
+	return polls;
+}
+
+static void test_crystalTimeout( void )
+{
+	sim_setCrystal( SIM_XT2, 0, 0 );
+	clock_init( 32768, 8000000, DCO_FREQ_2000KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	clock_set( MCLK, XT2, 1 );
+	TEST_EQUAL( clock_getCrystalStatus( ), CLOCK_CRYSTAL_PENDING );
+
+	/* Polled less often than CLOCK_CRYSTAL_POLL_MSEC, the timeout
+	 * still takes CLOCK_CRYSTAL_TIMEOUT_MSEC. */
+	TEST_RANGE( test_poll( 100 ), CLOCK_CRYSTAL_TIMEOUT_MSEC / 100, CLOCK_CRYSTAL_TIMEOUT_MSEC / 100 + 1 );
+	TEST_EQUAL( clock_getCrystalStatus( ), CLOCK_CRYSTAL_FAULT );
+
+	/* MCLK stays on the DCO. */
+	TEST_EQUAL( BCSCTL2 & SELM_3, SELM_0 );
+	TEST_EQUAL( clock_get( MCLK ), DCO_FREQ_2000KHz );
+
+	timer_uninit( );
+}
+
+static void test_crystalFails( void )
+{
+	sim_setCrystal( SIM_XT2, 8000000, 5000 );
+	clock_init( 32768, 8000000, DCO_FREQ_2000KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	clock_set( MCLK, XT2, 1 );
+	TEST_RANGE( test_poll( CLOCK_CRYSTAL_POLL_MSEC ), 1, 2 );
+	TEST_EQUAL( clock_getCrystalStatus( ), CLOCK_CRYSTAL_STABLE );
+	TEST_EQUAL( clock_get( MCLK ), 8000000 );
+
+	/* A glitch: the crystal stops and runs again before the NMI is
+	 * taken. The NMI moves MCLK to the DCO and clears the fault flag,
+	 * which is not set again. */
+	sim_setCrystal( SIM_XT2, 0, 0 );
+	sim_setCrystal( SIM_XT2, 8000000, 0 );
+	sim_runFor( 1000 );
+	TEST_EQUAL( sim_getIrqCount( NMI_VECTOR ), 1 );
+	TEST_EQUAL( clock_getCrystalStatus( ), CLOCK_CRYSTAL_FAULT );
+	TEST_EQUAL( clock_get( MCLK ), DCO_FREQ_2000KHz );
+	TEST_EQUAL( IFG1 & OFIFG, 0 );
+
+	timer_uninit( );
+}
+
+extern void clock_NMI_IRQ( void );
+
+static uint64_t test_nmiTime;
+
+/** Times the NMI handler of clock.c. */
+static void test_nmi( void )
+{
+	uint64_t time = sim_getTime( );
+	clock_NMI_IRQ( );
+	test_nmiTime = sim_getTime( ) - time;
+}
+
+static void test_faultDuringTx( void )
+{
+	static uint8_t data[64];
+	uint8_t buffer[sizeof( data ) + 1];
+	uint16_t size;
+	int i;
+
+	for( i = 0; i < ( int )sizeof( data ); i++ )
+		data[i] = ( uint8_t )( i + 1 );
+
+	sim_setCrystal( SIM_XT2, 8000000, 5000 );
+	clock_init( 32768, 8000000, DCO_FREQ_2000KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	clock_set( SMCLK, XT2, 1 );
+	test_poll( CLOCK_CRYSTAL_POLL_MSEC );
+	TEST_EQUAL( clock_get( SMCLK ), 8000000 );
+
+	serial_init( 0, CHAR_8BIT, 115200, SMCLK );
+	sim_uartSetBaud( 0, 115200 );
+	serial_writeBuffer( 0, data, sizeof( data ) );
+	sim_setVector( NMI_VECTOR, test_nmi );
+
+	/* The crystal fails in the middle of the data. */
+	sim_runFor( 2000 );
+	sim_setCrystal( SIM_XT2, 0, 0 );
+	sim_runFor( 100 );
+	TEST_EQUAL( sim_getIrqCount( NMI_VECTOR ), 1 );
+	TEST_EQUAL( clock_get( SMCLK ), DCO_FREQ_2000KHz );
+
+	/* The NMI waits for at most the two characters in the USART, of
+	 * 10 bits at 69 DCO cycles, 345 usec each, and retimes the port. */
+	TEST_RANGE( test_nmiTime, 1000, 2 * 345000 + 200000 );
+
+	/* Those are sent at a wrong rate, the others are not. */
+	serial_drain( 0 );
+	size = sim_uartReceive( 0, buffer, sizeof( buffer ) );
+	TEST_EQUAL( size, sizeof( data ) );
+	TEST_ASSERT( memcmp( buffer, data, sizeof( data ) ) == 0 );
+	TEST_EQUAL( sim_uartGetErrors( 0 ), 2 );
+
+	sim_setVector( NMI_VECTOR, NULL );
+	serial_uninit( 0 );
+	timer_uninit( );
+}
+
+static void test_levelCancelsPending( void )
+{
+	sim_setCrystal( SIM_XT2, 8000000, 5000 );
+	clock_init( 32768, 8000000, DCO_FREQ_2000KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	/* The switch to the crystal is pending when the performance
+	 * level is set, and is not made once the crystal is stable. */
+	clock_set( MCLK, XT2, 1 );
+	clock_set( SMCLK, XT2, 1 );
+	TEST_EQUAL( clock_getCrystalStatus( ), CLOCK_CRYSTAL_PENDING );
+
+	clock_setPerformanceLevel( DCO_FREQ_4900KHz, 1, 2 );
+	TEST_EQUAL( clock_getCrystalStatus( ), CLOCK_CRYSTAL_STABLE );
+
+	sim_runFor( 20000 );
+	TEST_EQUAL( clock_poll( ), CLOCK_CRYSTAL_STABLE );
+	TEST_EQUAL( BCSCTL2 & ( SELM_3 | SELS ), SELM_0 );
+	TEST_EQUAL( clock_get( MCLK ), DCO_FREQ_4900KHz );
+	TEST_EQUAL( clock_get( SMCLK ), DCO_FREQ_4900KHz / 2 );
+
+	timer_uninit( );
+}
+
+int main( void )
+{
+	TEST_RUN( test_calibrate );
+	TEST_RUN( test_deadCrystal );
+	TEST_RUN( test_crystalTimeout );
+	TEST_RUN( test_crystalFails );
+	TEST_RUN( test_levelCancelsPending );
+	TEST_RUN( test_faultDuringTx );
+
+	return TEST_RESULT( );
+}
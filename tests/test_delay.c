@@ -0,0 +1,84 @@
+/*
+ * Checks the microsecond timebase of timer.c and delay_us( ) of delay.c
+ * against the simulated time.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "delay.h"
+
+#include "test.h"
+
+static void test_init( uint32_t dco )
+{
+	clock_init( 32768, 0, dco );
+	timer_init( SMCLK, 1 );
+	__enable_interrupt( );
+}
+
+static void test_micros( void )
+{
+	unsigned long start, last, now;
+	uint64_t time;
+	int i, backwards = 0, off = 0;
+
+	test_init( DCO_FREQ_2000KHz );
+
+	time = sim_getTime( );
+	start = last = micros( );
+
+	/* Across many ticks, at steps that are not a multiple of a tick. */
+	for( i = 0; i < 1000; i++ )
+	{
+		sim_runFor( 37 );
+		now = micros( );
+		if( now < last )
+			backwards++;
+
+		/* The reads take a few usecs of the simulated time. */
+		long long error = ( long long )( now - start ) - ( long long )( ( sim_getTime( ) - time ) / 1000 );
+		if( error < -100 || error > 0 )
+			off++;
+
+		last = now;
+	}
+
+	TEST_EQUAL( backwards, 0 );
+	TEST_EQUAL( off, 0 );
+
+	timer_uninit( );
+}
+
+static void test_delayUs( void )
+{
+	static const unsigned int delays[] = { 50, 100, 500, 1000, 1999, 2001, 5000, 20000 };
+	static const uint32_t dcos[] = { DCO_FREQ_750KHz, DCO_FREQ_1300KHz, DCO_FREQ_2000KHz, DCO_FREQ_3200KHz, DCO_FREQ_4900KHz };
+	unsigned int i, j;
+
+	for( j = 0; j < sizeof( dcos ) / sizeof( dcos[0] ); j++ )
+	{
+		long long overhead = DELAY_US_OVERHEAD_CYCLES * 1000000LL / dcos[j];
+
+		test_init( dcos[j] );
+
+		for( i = 0; i < sizeof( delays ) / sizeof( delays[0] ); i++ )
+		{
+			uint64_t time = sim_getTime( );
+			delay_us( delays[i] );
+			time = ( sim_getTime( ) - time ) / 1000;
+
+			/* Within the call overhead, as the cycle counts of the simulator
+			 * are not exact, and extended by up to 10% by the timer interrupt. */
+			TEST_RANGE( time, ( long long )delays[i] - overhead, delays[i] + delays[i] / 10 + overhead );
+		}
+
+		timer_uninit( );
+	}
+}
+
+int main( void )
+{
+	TEST_RUN( test_micros );
+	TEST_RUN( test_delayUs );
+
+	return TEST_RESULT( );
+}
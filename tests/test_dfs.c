@@ -0,0 +1,104 @@
+/*
+ * Checks dynamic frequency scaling with clock_setPerformanceLevel( ):
+ * the UART keeps its baud rate and transmits every character, and the
+ * time of timer.c stays monotonic and accurate.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "serial.h"
+#include <msp430.h>
+
+#include "test.h"
+
+#include <string.h>
+
+#define TEST_TEXT_SIZE		200
+
+static void test_scaling( void )
+{
+	static const uint32_t levels[][2] =
+	{
+		{ DCO_FREQ_4900KHz, 1 }, { DCO_FREQ_750KHz, 1 }, { DCO_FREQ_2000KHz, 2 },
+		{ DCO_FREQ_1300KHz, 1 }, { DCO_FREQ_3200KHz, 2 }, { DCO_FREQ_2000KHz, 1 },
+	};
+	static uint8_t text[TEST_TEXT_SIZE], peer[TEST_TEXT_SIZE], buffer[TEST_TEXT_SIZE];
+	unsigned long last = 0, now;
+	uint64_t start_ns, elapsed;
+	unsigned long start_ms;
+	uint16_t received = 0, size;
+	int i, j, backwards = 0;
+
+	for( i = 0; i < TEST_TEXT_SIZE; i++ )
+	{
+		text[i] = ( uint8_t )( 'a' + i % 26 );
+		peer[i] = ( uint8_t )( 'A' + i % 26 );
+	}
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( SMCLK, 1 );
+	serial_init( 0, CHAR_8BIT, 9600, SMCLK );
+	sim_uartSetBaud( 0, 9600 );
+	__enable_interrupt( );
+
+	start_ns = sim_getTime( );
+	start_ms = timer_millis( );
+
+	/* Both directions busy while the level changes every few msec,
+	 * so the changes land in the middle of characters. */
+	sim_uartSend( 0, peer, TEST_TEXT_SIZE );
+	serial_writeBuffer( 0, text, 100 );
+
+	for( i = 0; i < 60; i++ )
+	{
+		clock_setPerformanceLevel( levels[i % 6][0], 1, levels[i % 6][1] );
+
+		sim_runFor( 2300 );
+		if( i == 20 )
+			serial_writeBuffer( 0, text + 100, 100 );
+
+		received += serial_readBuffer( 0, buffer + received, TEST_TEXT_SIZE - received );
+
+		now = timer_millis( );
+		if( now < last )
+			backwards++;
+		last = now;
+	}
+
+	serial_drain( 0 );
+	sim_runFor( 100000 );
+	received += serial_readBuffer( 0, buffer + received, TEST_TEXT_SIZE - received );
+
+	TEST_EQUAL( backwards, 0 );
+
+	/* Within 1% of the simulated time. */
+	now = timer_millis( ) - start_ms;
+	elapsed = ( sim_getTime( ) - start_ns ) / 1000000;
+	TEST_RANGE( now, elapsed * 99 / 100, elapsed * 101 / 100 );
+
+	TEST_EQUAL( sim_uartGetErrors( 0 ), 0 );
+
+	/* A character received while the dividers are reprogrammed is lost,
+	 * as the USART has no receive busy flag to wait for. The others
+	 * arrive in order. */
+	TEST_ASSERT( received >= TEST_TEXT_SIZE - 10 );
+	for( i = 0, j = 0; i < received; i++, j++ )
+	{
+		while( j < TEST_TEXT_SIZE && peer[j] != buffer[i] )
+			j++;
+	}
+	TEST_ASSERT( j <= TEST_TEXT_SIZE );
+
+	size = sim_uartReceive( 0, buffer, TEST_TEXT_SIZE );
+	TEST_EQUAL( size, TEST_TEXT_SIZE );
+	TEST_ASSERT( memcmp( buffer, text, TEST_TEXT_SIZE ) == 0 );
+
+	serial_uninit( 0 );
+	timer_uninit( );
+}
+
+int main( void )
+{
+	TEST_RUN( test_scaling );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,95 @@
+/*
+ * Checks the single producer, single consumer use of fifo.c: a timer
+ * interrupt pushes a sequence while the main program pops it. The
+ * interrupt is taken in the middle of the consumer's calls, as the
+ * simulator dispatches it at the loads of the library.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "fifo.h"
+
+#include "test.h"
+
+#define TEST_FIFO_SIZE		16
+#define TEST_COUNT			4000
+
+FIFO_DEFINE( test_fifo, TEST_FIFO_SIZE );
+
+static volatile uint16_t test_sent;
+
+/** Producer: pushes a burst of the sequence, of 1 to 13 bytes, as
+ * far as the FIFO has room. The rest follows on the next tick. */
+static void test_produce( void* user )
+{
+	uint16_t burst = 1 + test_sent % 13;
+
+	( void )user;
+
+	while( burst-- && test_sent < TEST_COUNT && !Fifo_full( &test_fifo ) )
+	{
+		Fifo_push( &test_fifo, ( uint8_t )test_sent );
+		test_sent++;
+	}
+}
+
+static void test_producerConsumer( void )
+{
+	static timer_t producer;
+	uint8_t buffer[3];
+	uint16_t received = 0, n, i;
+	int errors = 0, polls = 0;
+
+	/* The free-running positions wrap around 0xffff on the way. */
+	Fifo_init( &test_fifo, test_fifo_buffer, TEST_FIFO_SIZE );
+	test_fifo.wpos = test_fifo.rpos = 0xffff - TEST_COUNT / 2;
+	test_sent = 0;
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( SMCLK, 1 );
+	producer.mode = TIMER_MODE_PERIODIC;
+	producer.period_msec = 1;
+	producer.callback = test_produce;
+	timer_start( &producer );
+	__enable_interrupt( );
+
+	/* Consumer: alternates single bytes and short reads. Half of the
+	 * time it falls behind, and waits for the FIFO to fill, so that
+	 * the interrupt pushes while it reads the last free slot. Every
+	 * byte must be the next of the sequence. */
+	while( received < TEST_COUNT && polls++ < 10000000 )
+	{
+		if( ( received & 0x20 ) && test_sent < TEST_COUNT && !Fifo_full( &test_fifo ) )
+			continue;
+
+		if( received & 1 )
+		{
+			if( Fifo_get( &test_fifo, &buffer[0] ) )
+				errors += buffer[0] != ( uint8_t )received++;
+		}
+		else
+		{
+			n = Fifo_read( &test_fifo, buffer, sizeof( buffer ) );
+			for( i = 0; i < n; i++ )
+				errors += buffer[i] != ( uint8_t )received++;
+		}
+	}
+
+	timer_stop( &producer );
+	timer_uninit( );
+
+	TEST_EQUAL( received, TEST_COUNT );
+	TEST_EQUAL( errors, 0 );
+	TEST_EQUAL( test_fifo.dropped, 0 );
+	TEST_ASSERT( Fifo_empty( &test_fifo ) );
+	TEST_ASSERT( ( int16_t )test_fifo.rpos > 0 );
+
+	/* The interrupt did fill the FIFO. */
+	TEST_EQUAL( test_fifo.peak, TEST_FIFO_SIZE );
+}
+
+int main( void )
+{
+	TEST_RUN( test_producerConsumer );
+
+	return TEST_RESULT( );
+}
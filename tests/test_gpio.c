@@ -0,0 +1,210 @@
+/*
+ * Checks the pin interrupts of gpio.c against simulated inputs: the
+ * edges, and the emulated low level, which must not storm while the
+ * pin stays low. Also checks the port and pin group accesses, invalid
+ * ports, and the register lookup of the fast path.
+ */
+#include "gpio.h"
+
+#include "test.h"
+
+static int test_calls;
+static unsigned int test_pin;
+
+static void test_callback( unsigned int pin )
+{
+	test_calls++;
+	test_pin = pin;
+}
+
+static void test_init( uint8_t mode )
+{
+	test_calls = 0;
+	test_pin = 0;
+
+	sim_setPin( 1, 3, 1 );
+	GPIO_mode( 1, 3, INPUT );
+	GPIO_attachInterrupt( 1, 3, test_callback, mode );
+	__enable_interrupt( );
+}
+
+static void test_edges( void )
+{
+	int i;
+
+	test_init( FALLING );
+
+	for( i = 0; i < 3; i++ )
+	{
+		sim_setPin( 1, 3, 0 );
+		sim_runFor( 100 );
+		sim_setPin( 1, 3, 1 );
+		sim_runFor( 100 );
+	}
+
+	TEST_EQUAL( test_calls, 3 );
+	TEST_EQUAL( test_pin, P1_3 );
+
+	/* Not disarmed. */
+	GPIO_rearmInterrupt( 1, 3 );
+	TEST_EQUAL( test_calls, 3 );
+	TEST_EQUAL( P1IE, 1 << 3 );
+
+	GPIO_detachInterrupt( 1, 3 );
+}
+
+static void test_level( void )
+{
+	test_init( LEVEL );
+
+	/* Taken once while the pin stays low. */
+	sim_setPin( 1, 3, 0 );
+	sim_runFor( 1000 );
+	TEST_EQUAL( test_calls, 1 );
+	TEST_EQUAL( sim_getIrqCount( PORT1_VECTOR ), 1 );
+	TEST_EQUAL( P1IE, 0 );
+
+	/* Taken again at once if still low when re-armed. */
+	GPIO_rearmInterrupt( 1, 3 );
+	sim_runFor( 1000 );
+	TEST_EQUAL( test_calls, 2 );
+
+	/* Not taken while high, then on the next low level. */
+	sim_setPin( 1, 3, 1 );
+	GPIO_rearmInterrupt( 1, 3 );
+	sim_runFor( 1000 );
+	TEST_EQUAL( test_calls, 2 );
+	TEST_EQUAL( P1IE, 1 << 3 );
+
+	sim_setPin( 1, 3, 0 );
+	sim_runFor( 1000 );
+	TEST_EQUAL( test_calls, 3 );
+	TEST_EQUAL( sim_getIrqCount( PORT1_VECTOR ), 3 );
+
+	/* Low when attached. */
+	GPIO_detachInterrupt( 1, 3 );
+	GPIO_attachInterrupt( 1, 3, test_callback, LEVEL );
+	sim_runFor( 1000 );
+	TEST_EQUAL( test_calls, 4 );
+
+	GPIO_detachInterrupt( 1, 3 );
+}
+
+static void test_invalid( void )
+{
+	test_init( FALLING );
+	GPIO_detachInterrupt( 1, 3 );
+
+	/* Ignored: no such pin. */
+	GPIO_attachInterrupt( 1, 8, test_callback, FALLING );
+	GPIO_attachInterrupt( 3, 0, test_callback, FALLING );
+	GPIO_rearmInterrupt( 1, 8 );
+	TEST_EQUAL( P1IE, 0 );
+	TEST_EQUAL( P1IES, 1 << 3 );
+	TEST_EQUAL( P2IE, 0 );
+}
+
+static void test_ports( void )
+{
+	GPIO_group_t out, in;
+
+	GPIO_writePort( 5, 0xa5 );
+	TEST_EQUAL( P5OUT, 0xa5 );
+
+	/* Only the masked pins change. */
+	GPIO_writeMasked( 5, 0x0f, 0x3c );
+	TEST_EQUAL( P5OUT, 0xac );
+
+	sim_setPin( 6, 0, 1 );
+	sim_setPin( 6, 7, 1 );
+	TEST_EQUAL( GPIO_readPort( 6 ), 0x81 );
+
+	/* Pins 4 to 6: the value is aligned to pin 4, and the bits
+	 * beyond the group are ignored. */
+	GPIO_groupInit( &out, 5, 0x70, OUTPUT );
+	TEST_EQUAL( P5DIR, 0x70 );
+	GPIO_groupWrite( &out, 0x05 );
+	TEST_EQUAL( P5OUT, 0xdc );
+	GPIO_groupWrite( &out, 0xff );
+	TEST_EQUAL( P5OUT, 0xfc );
+	GPIO_groupWrite( &out, 0x00 );
+	TEST_EQUAL( P5OUT, 0x8c );
+
+	/* Pins 2 and 3. */
+	GPIO_groupInit( &in, 6, 0x0c, INPUT );
+	sim_setPin( 6, 2, 1 );
+	TEST_EQUAL( GPIO_groupRead( &in ), 0x01 );
+	sim_setPin( 6, 3, 1 );
+	TEST_EQUAL( GPIO_groupRead( &in ), 0x03 );
+
+	/* A group of pin 7 only. */
+	GPIO_groupInit( &in, 6, 0x80, INPUT );
+	TEST_EQUAL( GPIO_groupRead( &in ), 0x01 );
+}
+
+static void test_invalidPorts( void )
+{
+	GPIO_group_t group;
+
+	P5OUT = 0x0f;
+	P5DIR = 0;
+
+	/* Ignored, or read as 0. */
+	GPIO_writePort( 0, 0xff );
+	GPIO_writePort( 7, 0xff );
+	GPIO_writeMasked( 0, 0xff, 0xff );
+	GPIO_writeMasked( 7, 0xff, 0xff );
+	GPIO_set( 7, 0, HIGH );
+	GPIO_mode( 0, 0, OUTPUT );
+	TEST_EQUAL( GPIO_readPort( 0 ), 0 );
+	TEST_EQUAL( GPIO_readPort( 7 ), 0 );
+	TEST_EQUAL( GPIO_get( 7, 0 ), LOW );
+
+	/* An invalid port, or no pins, make an empty group. */
+	GPIO_groupInit( &group, 7, 0x01, OUTPUT );
+	TEST_EQUAL( group.mask, 0 );
+	GPIO_groupWrite( &group, 0xff );
+	TEST_EQUAL( GPIO_groupRead( &group ), 0 );
+
+	GPIO_groupInit( &group, 5, 0, OUTPUT );
+	TEST_EQUAL( group.mask, 0 );
+	GPIO_groupWrite( &group, 0xff );
+	TEST_EQUAL( GPIO_groupRead( &group ), 0 );
+
+	TEST_EQUAL( P5OUT, 0x0f );
+	TEST_EQUAL( P5DIR, 0 );
+}
+
+static void test_registers( void )
+{
+	/* Not known at compile time. */
+	volatile uint8_t port = 3;
+
+	TEST_ASSERT( GPIO_regOUT( port ) == &P3OUT );
+
+	port = 0;
+	TEST_ASSERT( GPIO_regIN( port ) == NULL );
+	TEST_ASSERT( GPIO_regOUT( port ) == NULL );
+	port = 7;
+	TEST_ASSERT( GPIO_regDIR( port ) == NULL );
+	TEST_ASSERT( GPIO_regSEL( port ) == NULL );
+
+	/* Resolved at compile time. The test is not hooked by the
+	 * simulator, so only the registers are checked. */
+	pinModeFast( P4_2, OUTPUT );
+	digitalWriteFast( P4_2, HIGH );
+	TEST_EQUAL( P4DIR, 1 << 2 );
+	TEST_EQUAL( P4OUT, 1 << 2 );
+}
+
+int main( void )
+{
+	TEST_RUN( test_edges );
+	TEST_RUN( test_level );
+	TEST_RUN( test_invalid );
+	TEST_RUN( test_ports );
+	TEST_RUN( test_invalidPorts );
+	TEST_RUN( test_registers );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,11 @@
+/*
+ * Must not compile: a constant pin of an invalid port in the fast path
+ * of gpio.h. Built by the test_gpio_invalid test, which expects the
+ * error of GPIO_invalidPort( ).
+ */
+#include "gpio.h"
+
+void test_invalidPort( void )
+{
+	digitalWriteFast( 0x0700, HIGH );
+}
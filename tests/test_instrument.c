@@ -0,0 +1,117 @@
+/*
+ * Checks the statistics of instrument.c, built with INSTRUMENT_ENABLE:
+ * the times of the timer and UART interrupts and of a timer callback,
+ * against the cycles the simulator runs, and the idle percentage over
+ * many overflows of TAR, counted by instrument_TIMERA1_IRQ( ).
+ */
+#include "clock.h"
+#include "timer.h"
+#include "delay.h"
+#include "serial.h"
+#include "instrument.h"
+#include <msp430.h>
+
+#include "test.h"
+
+/* TimerA runs from SMCLK at the DCO rate: a period is a cycle. */
+#define TEST_MCLK			4900000UL
+#define TEST_BUSY_CYCLES	1000
+
+static void test_busy( void* user )
+{
+	( void )user;
+	sim_run( TEST_BUSY_CYCLES );
+}
+
+static void test_init( void )
+{
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	timer_init( SMCLK, 1 );
+	instrument_init( );
+	__enable_interrupt( );
+}
+
+static void test_timerStats( void )
+{
+	static timer_t busy;
+	instrument_stats_t stats;
+	uint32_t ticks, overflows;
+
+	test_init( );
+
+	busy.mode = TIMER_MODE_PERIODIC;
+	busy.period_msec = 1;
+	busy.callback = test_busy;
+	timer_start( &busy );
+
+	instrument_reset( );
+	ticks = sim_getIrqCount( TIMERA0_VECTOR );
+	overflows = sim_getIrqCount( TIMERA1_VECTOR );
+	delay_sleep( 1000 );
+	ticks = sim_getIrqCount( TIMERA0_VECTOR ) - ticks;
+	overflows = sim_getIrqCount( TIMERA1_VECTOR ) - overflows;
+	timer_stop( &busy );
+
+	/* Every tick runs the callback, and the callback only runs the
+	 * busy cycles. */
+	TEST_ASSERT( instrument_getIsrStats( INSTRUMENT_ISR_TIMERA, &stats ) );
+	TEST_EQUAL( stats.count, ticks );
+	TEST_RANGE( stats.min, TEST_BUSY_CYCLES, TEST_BUSY_CYCLES + 400 );
+	TEST_RANGE( stats.max, stats.min, TEST_BUSY_CYCLES + 400 );
+	TEST_RANGE( stats.total, stats.count * stats.min, stats.count * stats.max );
+
+	TEST_RANGE( busy.stats.count, ticks - 1, ticks );
+	TEST_RANGE( busy.stats.min, TEST_BUSY_CYCLES, TEST_BUSY_CYCLES + 50 );
+	TEST_RANGE( busy.stats.max, busy.stats.min, TEST_BUSY_CYCLES + 50 );
+
+	/* TAR overflowed every 65536 cycles, and each overflow was counted
+	 * for the idle time: the ticks take a fifth of the time. */
+	TEST_RANGE( overflows, TEST_MCLK / 65536, TEST_MCLK / 65536 + 1 );
+	TEST_RANGE( instrument_getIdlePercent( ), 100 - 100 * ( TEST_BUSY_CYCLES + 400 ) * ticks / TEST_MCLK,
+		100 - 100 * TEST_BUSY_CYCLES * ticks / TEST_MCLK );
+
+	/* Without a callback, the CPU is almost always idle. */
+	instrument_reset( );
+	delay_sleep( 1000 );
+	TEST_RANGE( instrument_getIdlePercent( ), 97, 100 );
+
+	TEST_ASSERT( !instrument_getIsrStats( -1, &stats ) );
+	TEST_ASSERT( !instrument_getIsrStats( INSTRUMENT_NUM_ISRS, &stats ) );
+
+	timer_uninit( );
+}
+
+static void test_uartStats( void )
+{
+	static const uint8_t data[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	instrument_stats_t stats;
+
+	test_init( );
+	serial_init( 0, CHAR_8BIT, 115200, SMCLK );
+	sim_uartSetBaud( 0, 115200 );
+
+	instrument_reset( );
+	sim_uartSend( 0, data, sizeof( data ) );
+	sim_runFor( 2000 );
+
+	TEST_ASSERT( instrument_getIsrStats( INSTRUMENT_ISR_UART0_RX, &stats ) );
+	TEST_EQUAL( stats.count, sizeof( data ) );
+	TEST_RANGE( stats.min, 1, 200 );
+	TEST_RANGE( stats.max, stats.min, 200 );
+	TEST_RANGE( stats.total, stats.count * stats.min, stats.count * stats.max );
+
+	/* Nothing was sent. */
+	TEST_ASSERT( instrument_getIsrStats( INSTRUMENT_ISR_UART0_TX, &stats ) );
+	TEST_EQUAL( stats.count, 0 );
+
+	serial_uninit( 0 );
+	timer_uninit( );
+}
+
+int main( void )
+{
+	TEST_RUN( test_timerStats );
+	TEST_RUN( test_uartStats );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,221 @@
+/*
+ * Checks the UART driver of serial.c against the simulated USARTs: the
+ * bulk and zero-copy receive APIs, initializing a running port, and
+ * the statistics and return values when the FIFOs overflow.
+ */
+#include "clock.h"
+#include "serial.h"
+#include <msp430.h>
+
+#include "test.h"
+
+#include <string.h>
+
+static uint8_t test_data[SERIAL_RX_BUFFER_SIZE];
+
+static void test_init( int uart )
+{
+	int i;
+
+	for( i = 0; i < SERIAL_RX_BUFFER_SIZE; i++ )
+		test_data[i] = ( uint8_t )( i * 7 + 1 );
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	serial_init( uart, CHAR_8BIT, 115200, SMCLK );
+	sim_uartSetBaud( uart, 115200 );
+	__enable_interrupt( );
+}
+
+/** Sends size characters from the peer and lets them arrive. */
+static void test_receive( int uart, const uint8_t* data, uint16_t size )
+{
+	sim_uartSend( uart, data, size );
+	sim_runFor( size * 100 + 1000 );
+}
+
+static void test_readBuffer( void )
+{
+	uint8_t buffer[SERIAL_RX_BUFFER_SIZE];
+	int uart;
+
+	for( uart = 0; uart < SERIAL_NUM_PORTS; uart++ )
+	{
+		test_init( uart );
+
+		test_receive( uart, test_data, 100 );
+		TEST_EQUAL( serial_available( uart ), 100 );
+
+		/* A short buffer takes part, the rest stays. */
+		TEST_EQUAL( serial_readBuffer( uart, buffer, 30 ), 30 );
+		TEST_EQUAL( serial_readBuffer( uart, buffer + 30, sizeof( buffer ) ), 70 );
+		TEST_ASSERT( memcmp( buffer, test_data, 100 ) == 0 );
+		TEST_EQUAL( serial_readBuffer( uart, buffer, sizeof( buffer ) ), 0 );
+		TEST_EQUAL( sim_uartGetErrors( uart ), 0 );
+
+		serial_uninit( uart );
+	}
+}
+
+static void test_peekSpan( void )
+{
+	uint8_t buffer[SERIAL_RX_BUFFER_SIZE];
+	const uint8_t* span;
+	int n, count = 0;
+
+	test_init( 0 );
+
+	/* Move the read position near the end of the buffer. */
+	test_receive( 0, test_data, 100 );
+	serial_readBuffer( 0, buffer, sizeof( buffer ) );
+
+	/* Wraps around the end: two spans. */
+	test_receive( 0, test_data, 60 );
+	n = serial_peekSpan( 0, &span );
+	TEST_EQUAL( n, SERIAL_RX_BUFFER_SIZE - 100 );
+	memcpy( buffer, span, n );
+	serial_commit( 0, n );
+	count += n;
+
+	n = serial_peekSpan( 0, &span );
+	TEST_EQUAL( n, 60 - count );
+	memcpy( buffer + count, span, n );
+	serial_commit( 0, n );
+	count += n;
+
+	TEST_EQUAL( count, 60 );
+	TEST_ASSERT( memcmp( buffer, test_data, 60 ) == 0 );
+	TEST_EQUAL( serial_peekSpan( 0, &span ), 0 );
+
+	/* An invalid port returns no span. */
+	span = test_data;
+	TEST_EQUAL( serial_peekSpan( SERIAL_NUM_PORTS, &span ), 0 );
+	TEST_ASSERT( span == NULL );
+	span = test_data;
+	TEST_EQUAL( serial_peekSpan( -1, &span ), 0 );
+	TEST_ASSERT( span == NULL );
+
+	serial_uninit( 0 );
+}
+
+static void test_reinit( void )
+{
+	uint8_t buffer[SERIAL_TX_BUFFER_SIZE];
+	serial_stats_t stats;
+	uint16_t size;
+
+	test_init( 0 );
+
+	/* Initialize again while transmitting, with characters received. */
+	test_receive( 0, test_data, 10 );
+	serial_writeBuffer( 0, test_data, SERIAL_TX_BUFFER_SIZE - 8 );
+	sim_runFor( 1000 );
+	serial_init( 0, CHAR_8BIT, 115200, SMCLK );
+
+	/* Both FIFOs start empty and the port works. */
+	TEST_EQUAL( serial_available( 0 ), 0 );
+	serial_getStats( 0, &stats );
+	TEST_EQUAL( stats.rx_peak, 0 );
+	TEST_EQUAL( stats.tx_peak, 0 );
+
+	serial_putstr( 0, "ok" );
+	serial_drain( 0 );
+	sim_runFor( 1000 );
+
+	/* The characters sent before are a prefix of the data, and none of
+	 * the rest of the data follows. The one being shifted out is lost. */
+	size = sim_uartReceive( 0, buffer, sizeof( buffer ) );
+	TEST_RANGE( size, 3, SERIAL_TX_BUFFER_SIZE / 2 );
+	TEST_ASSERT( memcmp( buffer, test_data, size - 2 ) == 0 );
+	TEST_ASSERT( memcmp( buffer + size - 2, "ok", 2 ) == 0 );
+
+	test_receive( 0, test_data, 10 );
+	TEST_EQUAL( serial_readBuffer( 0, buffer, sizeof( buffer ) ), 10 );
+	TEST_ASSERT( memcmp( buffer, test_data, 10 ) == 0 );
+
+	serial_uninit( 0 );
+}
+
+static void test_rxStats( void )
+{
+	static uint8_t data[SERIAL_RX_BUFFER_SIZE + 10];
+	uint8_t buffer[SERIAL_RX_BUFFER_SIZE];
+	serial_stats_t stats;
+	int i;
+
+	for( i = 0; i < ( int )sizeof( data ); i++ )
+		data[i] = ( uint8_t )i;
+
+	test_init( 0 );
+
+	/* Ten characters more than the receive FIFO holds: the last
+	 * ten are dropped. */
+	test_receive( 0, data, sizeof( data ) );
+	serial_getStats( 0, &stats );
+	TEST_EQUAL( stats.rx_dropped, 10 );
+	TEST_EQUAL( stats.rx_peak, SERIAL_RX_BUFFER_SIZE );
+	TEST_EQUAL( stats.rx_overruns, 0 );
+	TEST_EQUAL( serial_readBuffer( 0, buffer, sizeof( buffer ) ), SERIAL_RX_BUFFER_SIZE );
+	TEST_ASSERT( memcmp( buffer, data, SERIAL_RX_BUFFER_SIZE ) == 0 );
+
+	/* Three characters while the interrupt is held off: the second
+	 * and third overwrite RXBUF, which is counted once, and only the
+	 * last is received. */
+	__disable_interrupt( );
+	test_receive( 0, data, 3 );
+	__enable_interrupt( );
+	sim_runFor( 100 );
+	serial_getStats( 0, &stats );
+	TEST_EQUAL( stats.rx_overruns, 1 );
+	TEST_EQUAL( stats.rx_dropped, 10 );
+	TEST_EQUAL( serial_readBuffer( 0, buffer, sizeof( buffer ) ), 1 );
+	TEST_EQUAL( buffer[0], data[2] );
+
+	/* An invalid port has no statistics. */
+	TEST_EQUAL( serial_getStats( SERIAL_NUM_PORTS, &stats ), 0 );
+
+	serial_uninit( 0 );
+}
+
+static void test_txFull( void )
+{
+	uint8_t buffer[SERIAL_TX_BUFFER_SIZE + 1];
+	serial_stats_t stats;
+
+	test_init( 0 );
+
+	/* Nothing is sent while the interrupt is held off, so the
+	 * transmit FIFO fills. */
+	__disable_interrupt( );
+	TEST_EQUAL( serial_writeBuffer( 0, test_data, SERIAL_TX_BUFFER_SIZE - 1 ), SERIAL_TX_BUFFER_SIZE - 1 );
+	TEST_EQUAL( serial_write( 0, test_data[SERIAL_TX_BUFFER_SIZE - 1] ), 1 );
+
+	/* Full: nothing more is queued, and each refusal is counted. */
+	TEST_EQUAL( serial_write( 0, 'x' ), 0 );
+	TEST_EQUAL( serial_writeBuffer( 0, test_data, 10 ), 0 );
+	serial_getStats( 0, &stats );
+	TEST_EQUAL( stats.tx_dropped, 2 );
+	TEST_EQUAL( stats.tx_peak, SERIAL_TX_BUFFER_SIZE );
+
+	/* The queued characters are sent, and nothing else. */
+	__enable_interrupt( );
+	serial_drain( 0 );
+	TEST_EQUAL( sim_uartReceive( 0, buffer, sizeof( buffer ) ), SERIAL_TX_BUFFER_SIZE );
+	TEST_ASSERT( memcmp( buffer, test_data, SERIAL_TX_BUFFER_SIZE ) == 0 );
+
+	/* Room again. */
+	TEST_EQUAL( serial_write( 0, 'x' ), 1 );
+	serial_drain( 0 );
+
+	serial_uninit( 0 );
+}
+
+int main( void )
+{
+	TEST_RUN( test_readBuffer );
+	TEST_RUN( test_peekSpan );
+	TEST_RUN( test_reinit );
+	TEST_RUN( test_rxStats );
+	TEST_RUN( test_txFull );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,129 @@
+/*
+ * Checks the simulator against the library: TimerA interrupts, UART
+ * transmit and receive, low power mode wake-up and interrupt requests.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "delay.h"
+#include "serial.h"
+#include "critical.h"
+
+#include "test.h"
+
+#include <string.h>
+
+static uint32_t test_wdtCount;
+
+static void test_wdtHandler( void )
+{
+	test_wdtCount++;
+}
+
+static void test_timerInterrupts( void )
+{
+	uint64_t time, cycles;
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( SMCLK, 1 );
+	__enable_interrupt( );
+
+	time = sim_getTime( );
+	cycles = sim_getCycles( );
+	sim_runFor( 10000 );
+
+	TEST_EQUAL( sim_getIrqCount( TIMERA0_VECTOR ), 10 );
+	TEST_EQUAL( millis( ), 10 );
+	/* 2 MHz for 10 ms, and the last interrupt handler. */
+	TEST_RANGE( sim_getTime( ) - time, 10000000, 10100000 );
+	TEST_RANGE( sim_getCycles( ) - cycles, 20000, 20200 );
+
+	timer_uninit( );
+}
+
+static void test_uart( void )
+{
+	uint8_t buffer[16];
+	uint16_t size;
+	uint64_t time;
+	int i;
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	serial_init( 0, CHAR_8BIT, 9600, SMCLK );
+	sim_uartSetBaud( 0, 9600 );
+	__enable_interrupt( );
+
+	time = sim_getTime( );
+	serial_putstr( 0, "hello" );
+	serial_drain( 0 );
+
+	/* 5 characters of 10 bits at 9600 baud. */
+	TEST_RANGE( sim_getTime( ) - time, 5208000, 5300000 );
+
+	size = sim_uartReceive( 0, buffer, sizeof( buffer ) );
+	TEST_EQUAL( size, 5 );
+	TEST_ASSERT( memcmp( buffer, "hello", 5 ) == 0 );
+	TEST_EQUAL( sim_uartGetErrors( 0 ), 0 );
+
+	sim_uartSend( 0, ( const uint8_t* )"abc", 3 );
+	sim_runFor( 5000 );
+
+	TEST_EQUAL( serial_available( 0 ), 3 );
+	for( i = 0; i < 3; i++ )
+		TEST_EQUAL( serial_read( 0 ), "abc"[i] );
+
+	serial_uninit( 0 );
+}
+
+static void test_sleep( void )
+{
+	uint64_t time, cycles;
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( SMCLK, 1 );
+	__enable_interrupt( );
+
+	time = sim_getTime( );
+	cycles = sim_getCycles( );
+	delay_sleep( 100 );
+
+	TEST_RANGE( sim_getTime( ) - time, 99000000, 101000000 );
+
+	/* The CPU only runs the interrupts while asleep. */
+	TEST_ASSERT( sim_getCycles( ) - cycles < 200000 / 10 );
+
+	timer_uninit( );
+}
+
+static void test_raise( void )
+{
+	test_wdtCount = 0;
+	sim_setVector( WDT_VECTOR, test_wdtHandler );
+
+	/* Held until interrupts are enabled. */
+	sim_raise( WDT_VECTOR );
+	sim_run( 100 );
+	TEST_EQUAL( test_wdtCount, 0 );
+
+	__enable_interrupt( );
+	sim_run( 100 );
+	TEST_EQUAL( test_wdtCount, 1 );
+	TEST_EQUAL( sim_getIrqCount( WDT_VECTOR ), 1 );
+
+	/* Masked by a critical section. */
+	critical_state_t state = critical_enter( );
+	sim_raise( WDT_VECTOR );
+	sim_run( 100 );
+	TEST_EQUAL( test_wdtCount, 1 );
+	critical_exit( state );
+	TEST_EQUAL( test_wdtCount, 2 );
+}
+
+int main( void )
+{
+	TEST_RUN( test_timerInterrupts );
+	TEST_RUN( test_uart );
+	TEST_RUN( test_sleep );
+	TEST_RUN( test_raise );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,136 @@
+/*
+ * Checks the SPI frame loops of spi.c against a simulated slave, and
+ * compares their throughput with the former loops of spi_legacy.c.
+ */
+#include "clock.h"
+#include "spi.h"
+#include "spi_legacy.h"
+
+#include "test.h"
+
+#include <string.h>
+
+#define TEST_FRAME_SIZE		64
+
+static uint8_t test_out[TEST_FRAME_SIZE];
+static uint8_t test_in[TEST_FRAME_SIZE];
+
+/** The slave answers each byte with its complement. */
+static uint8_t test_slave( uint8_t mosi )
+{
+	return ( uint8_t )~mosi;
+}
+
+static void test_init( uint32_t clock_rate )
+{
+	int i;
+
+	for( i = 0; i < TEST_FRAME_SIZE; i++ )
+		test_out[i] = ( uint8_t )( i * 13 + 5 );
+	memset( test_in, 0, sizeof( test_in ) );
+
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	sim_setSlave( test_slave );
+	SPI_init( 1, SPI_MODE0, clock_rate, SMCLK );
+}
+
+static void test_frames( void )
+{
+	uint16_t size;
+	int i;
+
+	/* Sizes around the unrolled loop. */
+	for( size = 1; size <= 9; size++ )
+	{
+		test_init( 1000000 );
+
+		memset( test_in, 0, sizeof( test_in ) );
+		SPI_transferFrame( 1, test_in, test_out, size );
+		for( i = 0; i < TEST_FRAME_SIZE; i++ )
+			TEST_EQUAL( test_in[i], i < size ? ( uint8_t )~test_out[i] : 0 );
+
+		/* The complement of the dummy bytes. */
+		memset( test_in, 0x55, sizeof( test_in ) );
+		SPI_receiveFrame( 1, test_in, size );
+		for( i = 0; i < TEST_FRAME_SIZE; i++ )
+			TEST_EQUAL( test_in[i], i < size ? 0x00 : 0x55 );
+
+		SPI_transmitFrame( 1, test_out, size );
+		TEST_EQUAL( IFG2 & URXIFG1, 0 );
+
+		TEST_EQUAL( SPI_transferByte( 1, 0x5A ), 0xA5 );
+		TEST_EQUAL( sim_uartGetErrors( 1 ), 0 );
+
+		SPI_uninit( 1 );
+	}
+}
+
+/** Returns the time in nsec of a transfer of TEST_FRAME_SIZE bytes. */
+static uint64_t test_timeTransfer( int legacy )
+{
+	uint64_t time = sim_getTime( );
+
+	if( legacy )
+		spi_legacy_transferFrame( test_in, test_out, TEST_FRAME_SIZE );
+	else
+		SPI_transferFrame( 1, test_in, test_out, TEST_FRAME_SIZE );
+
+	return sim_getTime( ) - time;
+}
+
+static void test_throughput( void )
+{
+	static const uint32_t rates[] = { 2450000, 1225000, 612500, 306250 };
+	unsigned int i;
+
+	printf( "  SPI clock   old usec   new usec   (%d byte transfer, 4.9 MHz MCLK)\n", TEST_FRAME_SIZE );
+
+	for( i = 0; i < sizeof( rates ) / sizeof( rates[0] ); i++ )
+	{
+		uint64_t old_ns, new_ns;
+
+		test_init( rates[i] );
+		old_ns = test_timeTransfer( 1 );
+		new_ns = test_timeTransfer( 0 );
+
+		printf( "  %9lu   %8lu   %8lu\n", ( unsigned long )rates[i],
+			( unsigned long )( old_ns / 1000 ), ( unsigned long )( new_ns / 1000 ) );
+
+		/* No slower at any rate; both receive every byte. */
+		TEST_ASSERT( new_ns <= old_ns );
+		TEST_EQUAL( sim_uartGetErrors( 1 ), 0 );
+
+		/* Never slower than the bytes themselves. */
+		TEST_ASSERT( new_ns >= TEST_FRAME_SIZE * 8 * 1000000000ULL / rates[i] );
+
+		SPI_uninit( 1 );
+	}
+}
+
+static void test_noChipSelect( void )
+{
+	SPI_device_t device;
+	int port;
+
+	test_init( 1000000 );
+
+	/* Pin 0 has no port: the pins are left alone. */
+	SPI_deviceInit( &device, 0, SPI_MODE0, 500000, SMCLK );
+	SPI_beginTransaction( 1, &device );
+	TEST_EQUAL( SPI_transferByte( 1, 0x5A ), 0xA5 );
+	SPI_endTransaction( 1, &device );
+
+	for( port = 1; port <= 4; port++ )
+		TEST_EQUAL( sim_getPins( port ), 0 );
+
+	SPI_uninit( 1 );
+}
+
+int main( void )
+{
+	TEST_RUN( test_frames );
+	TEST_RUN( test_noChipSelect );
+	TEST_RUN( test_throughput );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,130 @@
+/*
+ * Checks the interrupt driven SPI transfers of spi.c against a simulated
+ * slave: the data, the order of completion, the queue limit and queueing
+ * from a completion callback.
+ */
+#include "clock.h"
+#include "spi.h"
+
+#include "test.h"
+
+#include <string.h>
+
+static uint8_t test_order[8];
+static int test_completed;
+
+/** The slave answers each byte with its complement. */
+static uint8_t test_slave( uint8_t mosi )
+{
+	return ( uint8_t )~mosi;
+}
+
+static void test_done( void* user )
+{
+	test_order[test_completed++] = ( uint8_t )( intptr_t )user;
+}
+
+static void test_init( void )
+{
+	test_completed = 0;
+
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	sim_setSlave( test_slave );
+	SPI_init( 1, SPI_MODE0, 500000, SMCLK );
+	__enable_interrupt( );
+}
+
+/** Sleeps until the transfers complete, as the main loop would.
+ * Checking and sleeping with interrupts disabled, and enabling them
+ * in the same instruction as LPM, cannot miss the last wake-up. */
+static void test_wait( void )
+{
+	__disable_interrupt( );
+	while( SPI_isBusy( 1 ) )
+	{
+		__bis_SR_register( LPM0_bits | GIE );
+		__disable_interrupt( );
+	}
+	__enable_interrupt( );
+}
+
+static void test_queue( void )
+{
+	uint8_t out[3][16], in[3][16];
+	int i, j;
+
+	test_init( );
+
+	for( i = 0; i < 3; i++ )
+		for( j = 0; j < 16; j++ )
+			out[i][j] = ( uint8_t )( i * 16 + j );
+	memset( in, 0x55, sizeof( in ) );
+
+	/* No transfer completes while the queue is filled, so that the
+	 * fifth finds it full however fast the first ones run. */
+	__disable_interrupt( );
+	TEST_EQUAL( SPI_transferFrameAsync( 1, in[0], out[0], 16, test_done, ( void* )1 ), 1 );
+	TEST_EQUAL( SPI_transferFrameAsync( 1, in[1], out[1], 5, test_done, ( void* )2 ), 1 );
+	TEST_EQUAL( SPI_transferFrameAsync( 1, in[2], NULL, 16, test_done, ( void* )3 ), 1 );
+	TEST_EQUAL( SPI_transferFrameAsync( 1, NULL, out[2], 16, test_done, ( void* )4 ), 1 );
+
+	/* The queue is full, and empty transfers are refused. */
+	TEST_EQUAL( SPI_transferFrameAsync( 1, in[0], out[0], 1, test_done, ( void* )5 ), 0 );
+	TEST_EQUAL( SPI_transferFrameAsync( 1, in[0], out[0], 0, test_done, ( void* )5 ), 0 );
+	TEST_EQUAL( SPI_isBusy( 1 ), 1 );
+
+	test_wait( );
+
+	TEST_EQUAL( test_completed, 4 );
+	for( i = 0; i < 4; i++ )
+		TEST_EQUAL( test_order[i], i + 1 );
+
+	for( j = 0; j < 16; j++ )
+	{
+		TEST_EQUAL( in[0][j], ( uint8_t )~out[0][j] );
+		TEST_EQUAL( in[1][j], j < 5 ? ( uint8_t )~out[1][j] : 0x55 );
+		TEST_EQUAL( in[2][j], 0x00 );	/* The complement of the dummy bytes */
+	}
+
+	SPI_uninit( 1 );
+}
+
+static uint8_t test_chainIn[4];
+static const uint8_t test_chainOut[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+static void test_chain( void* user )
+{
+	test_done( user );
+
+	/* Queued from the callback, into the slot being freed. */
+	if( test_completed < 4 )
+		SPI_transferFrameAsync( 1, test_chainIn, test_chainOut, 4, test_chain, ( void* )( intptr_t )( test_completed + 1 ) );
+}
+
+static void test_callbackQueues( void )
+{
+	int i;
+
+	test_init( );
+
+	TEST_EQUAL( SPI_transferFrameAsync( 1, test_chainIn, test_chainOut, 4, test_chain, ( void* )1 ), 1 );
+	test_wait( );
+
+	TEST_EQUAL( test_completed, 4 );
+	for( i = 0; i < 4; i++ )
+	{
+		TEST_EQUAL( test_order[i], i + 1 );
+		TEST_EQUAL( test_chainIn[i], ( uint8_t )~test_chainOut[i] );
+	}
+	TEST_EQUAL( sim_uartGetErrors( 1 ), 0 );
+
+	SPI_uninit( 1 );
+}
+
+int main( void )
+{
+	TEST_RUN( test_queue );
+	TEST_RUN( test_callbackQueues );
+
+	return TEST_RESULT( );
+}
@@ -0,0 +1,380 @@
+/*
+ * Checks the software timers of timer.c: the expiry of the timers on
+ * the timing wheel, including timers that share a slot, and stopping
+ * and restarting timers anywhere in their slot, many timers expiring
+ * on one tick, and the queue of the deferred timers. Also built in
+ * tickless mode, where the interrupt catches up on many ticks at once
+ * and is taken far less often for sparse timers.
+ */
+#include "clock.h"
+#include "timer.h"
+#include "delay.h"
+
+#include "test.h"
+
+/** A timer that records its expirations. */
+typedef struct
+{
+	timer_t timer;
+	unsigned long start;	/* timer_millis( ) when started */
+	int count;				/* Expirations */
+	int late;				/* Expirations off the period */
+} test_timer_t;
+
+static void test_expired( void* user )
+{
+	test_timer_t* t = ( test_timer_t* )user;
+
+	t->count++;
+	if( ( timer_millis( ) - t->start ) != ( unsigned long )t->count * t->timer.period_msec )
+		t->late++;
+}
+
+static void test_startTimer( test_timer_t* t, int mode, int period_msec )
+{
+	t->timer.mode = mode;
+	t->timer.period_msec = period_msec;
+	t->timer.callback = test_expired;
+	t->timer.user = t;
+	t->count = 0;
+	t->late = 0;
+	t->start = timer_millis( );
+	timer_start( &t->timer );
+}
+
+static void test_init( void )
+{
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( SMCLK, 1 );
+	__enable_interrupt( );
+}
+
+static void test_wheelPeriodic( void )
+{
+	static const int periods[] = { 1, 5, 31, 32, 33, 64, 100, 250 };
+	static test_timer_t timers[8];
+	int i;
+
+	test_init( );
+
+	/* 32 and 64 hash into the slot of their start tick, 33 wraps the wheel. */
+	for( i = 0; i < 8; i++ )
+		test_startTimer( &timers[i], TIMER_MODE_PERIODIC, periods[i] );
+
+	sim_runFor( 1000500 );
+
+	for( i = 0; i < 8; i++ )
+	{
+		TEST_EQUAL( timers[i].count, ( timer_millis( ) - timers[i].start ) / periods[i] );
+		TEST_EQUAL( timers[i].late, 0 );
+		timer_stop( &timers[i].timer );
+	}
+
+	timer_uninit( );
+}
+
+static void test_wheelOneshot( void )
+{
+	static test_timer_t first, second;
+
+	test_init( );
+
+	/* Both in the same slot, a turn of the wheel apart. */
+	test_startTimer( &first, TIMER_MODE_ONESHOT, 8 );
+	test_startTimer( &second, TIMER_MODE_ONESHOT, 8 + TIMER_WHEEL_SIZE );
+
+	sim_runFor( 8500 );
+	TEST_EQUAL( first.count, 1 );
+	TEST_EQUAL( second.count, 0 );
+
+	sim_runFor( TIMER_WHEEL_SIZE * 1000 );
+	TEST_EQUAL( first.count, 1 );
+	TEST_EQUAL( second.count, 1 );
+	TEST_EQUAL( first.late + second.late, 0 );
+
+	/* One-shot timers do not restart. */
+	sim_runFor( 100000 );
+	TEST_EQUAL( first.count, 1 );
+	TEST_EQUAL( second.count, 1 );
+
+	timer_uninit( );
+}
+
+static test_timer_t* test_victim;
+
+static void test_stopVictim( void* user )
+{
+	test_expired( user );
+	timer_stop( &test_victim->timer );
+}
+
+static void test_stopInSlot( void )
+{
+	static test_timer_t timers[3];
+	int i;
+
+	test_init( );
+
+	/* Three timers in one slot; the last started is at its head.
+	 * Stop the middle and the head. */
+	for( i = 0; i < 3; i++ )
+		test_startTimer( &timers[i], TIMER_MODE_ONESHOT, 10 + i * TIMER_WHEEL_SIZE );
+	timer_stop( &timers[1].timer );
+	timer_stop( &timers[2].timer );
+
+	/* Stopping twice is harmless. */
+	timer_stop( &timers[1].timer );
+
+	sim_runFor( 3 * TIMER_WHEEL_SIZE * 1000 );
+	for( i = 0; i < 3; i++ )
+		TEST_EQUAL( timers[i].count, i == 0 );
+
+	/* Again, stopping the tail. */
+	for( i = 0; i < 3; i++ )
+		test_startTimer( &timers[i], TIMER_MODE_ONESHOT, 10 + i * TIMER_WHEEL_SIZE );
+	timer_stop( &timers[0].timer );
+
+	sim_runFor( 3 * TIMER_WHEEL_SIZE * 1000 );
+	for( i = 0; i < 3; i++ )
+		TEST_EQUAL( timers[i].count, i != 0 );
+	TEST_EQUAL( timers[1].late + timers[2].late, 0 );
+
+	timer_uninit( );
+}
+
+static void test_stopFromCallback( void )
+{
+	static test_timer_t first, second;
+
+	test_init( );
+
+	/* Both expire on the same tick; whichever runs first stops the other. */
+	test_startTimer( &first, TIMER_MODE_PERIODIC, 10 );
+	test_startTimer( &second, TIMER_MODE_PERIODIC, 10 );
+	first.timer.callback = test_stopVictim;
+	second.timer.callback = test_stopVictim;
+	test_victim = &first;
+
+	sim_runFor( 10500 );
+	TEST_EQUAL( first.count + second.count, 1 );
+
+	/* Second, at the head of the slot, ran and stopped first. */
+	TEST_EQUAL( second.count, 1 );
+	TEST_EQUAL( first.timer.armed, 0 );
+
+	timer_stop( &second.timer );
+	timer_uninit( );
+}
+
+static void test_restart( void )
+{
+	static test_timer_t t;
+
+	test_init( );
+
+	test_startTimer( &t, TIMER_MODE_PERIODIC, 20 );
+
+	/* Starting a running timer does not move its expiry. */
+	sim_runFor( 10000 );
+	timer_start( &t.timer );
+	sim_runFor( 10500 );
+	TEST_EQUAL( t.count, 1 );
+	TEST_EQUAL( t.late, 0 );
+
+	/* Restarted after a stop, it runs a full period from then. */
+	timer_stop( &t.timer );
+	sim_runFor( 5000 );
+	test_startTimer( &t, TIMER_MODE_PERIODIC, 20 );
+	sim_runFor( 40500 );
+	TEST_EQUAL( t.count, 2 );
+	TEST_EQUAL( t.late, 0 );
+
+	timer_stop( &t.timer );
+	timer_uninit( );
+}
+
+static void test_deferredRestart( void )
+{
+	static test_timer_t t;
+	uint16_t drops = timer_getDeferredDrops( );
+	int i;
+
+	test_init( );
+
+	/* Stopped and started again while queued, more times than the
+	 * queue holds: the timer keeps its single entry. */
+	test_startTimer( &t, TIMER_MODE_PERIODIC | TIMER_MODE_DEFERRED, 10 );
+	for( i = 0; i < 2 * TIMER_DEFERRED_QUEUE_SIZE; i++ )
+	{
+		sim_runFor( 10500 );
+		timer_stop( &t.timer );
+		test_startTimer( &t, TIMER_MODE_PERIODIC | TIMER_MODE_DEFERRED, 10 );
+	}
+
+	/* Expirations before the service are coalesced. */
+	sim_runFor( 30500 );
+	TEST_EQUAL( timer_service( ), 1 );
+	TEST_EQUAL( t.count, 1 );
+	TEST_EQUAL( timer_getDeferredDrops( ), drops );
+	TEST_EQUAL( timer_service( ), 0 );
+
+	timer_stop( &t.timer );
+	timer_uninit( );
+}
+
+static void test_deferredDrops( void )
+{
+	static test_timer_t timers[TIMER_DEFERRED_QUEUE_SIZE + 1];
+	uint16_t drops = timer_getDeferredDrops( );
+	int i, count = 0;
+
+	test_init( );
+
+	/* One more than the queue holds. */
+	for( i = 0; i < TIMER_DEFERRED_QUEUE_SIZE + 1; i++ )
+		test_startTimer( &timers[i], TIMER_MODE_ONESHOT | TIMER_MODE_DEFERRED, 10 );
+
+	sim_runFor( 10500 );
+	TEST_EQUAL( timer_getDeferredDrops( ) - drops, 1 );
+	TEST_EQUAL( timer_service( ), TIMER_DEFERRED_QUEUE_SIZE );
+
+	for( i = 0; i < TIMER_DEFERRED_QUEUE_SIZE + 1; i++ )
+	{
+		count += timers[i].count;
+		timer_stop( &timers[i].timer );
+	}
+	TEST_EQUAL( count, TIMER_DEFERRED_QUEUE_SIZE );
+
+	timer_uninit( );
+}
+
+static int test_count;
+
+static void test_counted( void* user )
+{
+	( void )user;
+	test_count++;
+}
+
+static void test_sameTick( void )
+{
+	static timer_t timers[100];
+	uint64_t cycles;
+	unsigned long start;
+	int i;
+
+	/* ACLK is stopped while the timers are started, so that all
+	 * start on one tick. A period of a wheel turn puts them back at
+	 * the head of their slot on every expiry. */
+	clock_init( 32768, 0, DCO_FREQ_4900KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	sim_setCrystal( SIM_XT1, 0, 0 );
+	start = timer_millis( );
+	for( i = 0; i < 100; i++ )
+	{
+		timers[i].mode = TIMER_MODE_PERIODIC;
+		timers[i].period_msec = TIMER_WHEEL_SIZE;
+		timers[i].callback = test_counted;
+		timer_start( &timers[i] );
+	}
+	TEST_EQUAL( timer_millis( ), start );
+	sim_setCrystal( SIM_XT1, 32768, 0 );
+
+	test_count = 0;
+	cycles = sim_getCycles( );
+	delay_sleep( 3 * TIMER_WHEEL_SIZE );
+	cycles = sim_getCycles( ) - cycles;
+
+	/* Each timer runs once per expiry, and the slot is walked once:
+	 * the time grows with the timers, not with their square. */
+	TEST_EQUAL( test_count, 3 * 100 );
+	TEST_ASSERT( cycles < 3 * 100 * 250 );
+
+	for( i = 0; i < 100; i++ )
+		timer_stop( &timers[i] );
+	timer_uninit( );
+}
+
+static void test_sparseIrqs( void )
+{
+	static test_timer_t timers[2];
+	unsigned long ticks;
+	uint32_t irqs;
+	int expiries;
+
+	/* Two sparse timers for ten seconds. On ACLK a TAR interval
+	 * holds 1024 ticks, so in tickless mode the interrupt is not
+	 * taken between the expiries. */
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	test_startTimer( &timers[0], TIMER_MODE_PERIODIC, 100 );
+	test_startTimer( &timers[1], TIMER_MODE_PERIODIC, 250 );
+
+	ticks = timer_millis( );
+	irqs = sim_getIrqCount( TIMERA0_VECTOR );
+	sim_runFor( 10 * 1000000UL );
+	ticks = timer_millis( ) - ticks;
+	irqs = sim_getIrqCount( TIMERA0_VECTOR ) - irqs;
+	expiries = timers[0].count + timers[1].count;
+
+	TEST_EQUAL( timers[0].late + timers[1].late, 0 );
+	TEST_EQUAL( expiries, ticks / 100 + ticks / 250 );
+
+#if TIMER_TICKLESS
+	/* An interrupt per expiry tick, the shared ticks of both timers
+	 * counting once: about a hundredth of the periodic interrupts. */
+	TEST_RANGE( irqs, expiries - expiries / 5, expiries );
+	TEST_ASSERT( irqs * 50 < ticks );
+#else
+	/* An interrupt per tick, expiring or not. */
+	TEST_RANGE( irqs, ticks - 1, ticks + 1 );
+#endif
+
+	timer_stop( &timers[0].timer );
+	timer_stop( &timers[1].timer );
+	timer_uninit( );
+}
+
+#if TIMER_TICKLESS
+static void test_catchUp( void )
+{
+	uint64_t cycles;
+
+	/* An ACLK tick is 32 counts, so a second is one interrupt. */
+	clock_init( 32768, 0, DCO_FREQ_2000KHz );
+	timer_init( ACLK, 1 );
+	__enable_interrupt( );
+
+	cycles = sim_getCycles( );
+	delay_sleep( 1000 );
+
+	/* Skipping the empty slots, the interrupt does not visit each of
+	 * the 1000 ticks. */
+	TEST_RANGE( sim_getIrqCount( TIMERA0_VECTOR ), 1, 2 );
+	TEST_ASSERT( sim_getCycles( ) - cycles < 3000 );
+
+	timer_uninit( );
+}
+#endif
+
+int main( void )
+{
+	TEST_RUN( test_wheelPeriodic );
+	TEST_RUN( test_wheelOneshot );
+	TEST_RUN( test_stopInSlot );
+	TEST_RUN( test_stopFromCallback );
+	TEST_RUN( test_restart );
+	TEST_RUN( test_deferredRestart );
+	TEST_RUN( test_deferredDrops );
+	TEST_RUN( test_sameTick );
+	TEST_RUN( test_sparseIrqs );
+#if TIMER_TICKLESS
+	TEST_RUN( test_catchUp );
+#endif
+
+	return TEST_RESULT( );
+}
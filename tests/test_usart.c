@@ -0,0 +1,189 @@
+/*
+ * Checks the baud rate dividers of usart.c against the values of the
+ * MSP430x1xx Family User's Guide (SLAU049), table "Commonly Used Baud
+ * Rates, Baud Rate Data, and Errors", the error at the DCO presets,
+ * and the clamping of rates too slow for the clock, or 0.
+ */
+#include "usart.h"
+#include "clock.h"
+
+#include "test.h"
+
+typedef struct
+{
+	uint32_t clk;
+	uint32_t baud;
+	uint16_t ubr;
+	uint8_t umctl;
+} test_divider_t;
+
+static const test_divider_t test_reference[] =
+{
+	{ 32768, 1200, 0x001B, 0x03 },
+	{ 32768, 2400, 0x000D, 0x6B },
+	{ 32768, 4800, 0x0006, 0x6F },
+	{ 32768, 9600, 0x0003, 0x4A },
+	{ 1048576, 1200, 0x0369, 0xFF },
+	{ 1048576, 2400, 0x01B4, 0xFF },
+	{ 1048576, 4800, 0x00DA, 0x55 },
+	{ 1048576, 9600, 0x006D, 0x03 },
+	{ 1048576, 19200, 0x0036, 0x6B },
+	{ 1048576, 38400, 0x001B, 0x03 },
+	{ 1048576, 76800, 0x000D, 0x6B },
+	{ 1048576, 115200, 0x0009, 0x08 },
+};
+
+/* The same dividers at compile time, for a few entries. */
+static const usart_divider_t test_constant[] =
+{
+	USART_DIVIDER( 32768, 9600 ),
+	USART_DIVIDER( 1048576, 1200 ),
+	USART_DIVIDER( 1048576, 115200 ),
+	USART_DIVIDER( 8000000, 100 ),
+	USART_DIVIDER( 32768, 0 ),
+};
+
+static int test_bits( uint8_t x )
+{
+	int n = 0;
+
+	for( ; x; x >>= 1 )
+		n += x & 1;
+	return n;
+}
+
+/**
+ * Returns the largest transmit timing error, in bits, over a character
+ * of 10 bits, by the error formula of the User's Guide: the modulation
+ * bits apply to successive bits, wrapping after 8.
+ */
+static double test_maxError( uint32_t clk, uint32_t baud, uint16_t ubr, uint8_t umctl )
+{
+	double worst = 0;
+	uint32_t clocks = 0;
+	int j;
+
+	for( j = 0; j < 10; j++ )
+	{
+		clocks += ubr + ( ( umctl >> ( j & 7 ) ) & 1 );
+
+		double error = ( double )clocks * baud / clk - ( j + 1 );
+		if( error < 0 )
+			error = -error;
+		if( error > worst )
+			worst = error;
+	}
+
+	return worst;
+}
+
+static void test_referenceTable( void )
+{
+	unsigned int i;
+
+	printf( "  clock Hz     baud   UBR   UMCTL (reference)   max error %% (reference)\n" );
+
+	for( i = 0; i < sizeof( test_reference ) / sizeof( test_reference[0] ); i++ )
+	{
+		const test_divider_t* r = &test_reference[i];
+		usart_divider_t div;
+		uint16_t ubr;
+		double error, reference;
+
+		usart_calcDivider( r->clk, r->baud, &div );
+		ubr = div.ubr0 | ( div.ubr1 << 8 );
+		error = test_maxError( r->clk, r->baud, ubr, div.umctl );
+		reference = test_maxError( r->clk, r->baud, r->ubr, r->umctl );
+
+		printf( "  %8lu   %6lu  0x%04X   0x%02X (0x%02X)        %5.1f (%5.1f)\n", ( unsigned long )r->clk,
+			( unsigned long )r->baud, ubr, div.umctl, r->umctl, error * 100, reference * 100 );
+
+		TEST_EQUAL( ubr, r->ubr );
+
+		/* The modulation rounds the timing of each of the 8 modulated
+		 * bits, so it is about as good as the reference pattern. It can
+		 * be slightly worse on the bits after the wrap, e.g. 10.7% against
+		 * 10.2% at 32768 Hz and 4800 baud. */
+		TEST_ASSERT( error <= reference + 0.01 );
+	}
+}
+
+static void test_dcoPresets( void )
+{
+	static const uint32_t dcos[] = { DCO_FREQ_750KHz, DCO_FREQ_1300KHz, DCO_FREQ_2000KHz, DCO_FREQ_3200KHz, DCO_FREQ_4900KHz };
+	static const uint32_t bauds[] = { 9600, 19200, 38400, 57600, 115200 };
+	unsigned int i, j;
+
+	printf( "  clock Hz     baud   UBR   UMCTL   max error %% (bound)\n" );
+
+	for( i = 0; i < sizeof( dcos ) / sizeof( dcos[0] ); i++ )
+	{
+		for( j = 0; j < sizeof( bauds ) / sizeof( bauds[0] ); j++ )
+		{
+			usart_divider_t div;
+			uint16_t ubr;
+			double error, bound;
+
+			usart_calcDivider( dcos[i], bauds[j], &div );
+			ubr = div.ubr0 | ( div.ubr1 << 8 );
+			error = test_maxError( dcos[i], bauds[j], ubr, div.umctl );
+
+			/* The first 8 bits end within half a clock of their ideal
+			 * time. Bits 9 and 10 repeat the modulation of bits 1 and 2,
+			 * so their errors add those of bit 8 and bits 1 and 2: one
+			 * clock at most. */
+			bound = ( double )bauds[j] / dcos[i];
+
+			printf( "  %8lu   %6lu  0x%04X   0x%02X      %5.1f (%5.1f)\n", ( unsigned long )dcos[i],
+				( unsigned long )bauds[j], ubr, div.umctl, error * 100, bound * 100 );
+
+			TEST_EQUAL( ubr, dcos[i] / bauds[j] );
+			TEST_ASSERT( error <= bound + 1e-9 );
+		}
+	}
+}
+
+static void test_macros( void )
+{
+	static const uint32_t args[][2] = { { 32768, 9600 }, { 1048576, 1200 }, { 1048576, 115200 }, { 8000000, 100 }, { 32768, 0 } };
+	unsigned int i;
+
+	for( i = 0; i < sizeof( args ) / sizeof( args[0] ); i++ )
+	{
+		usart_divider_t div;
+
+		usart_calcDivider( args[i][0], args[i][1], &div );
+		TEST_EQUAL( div.ubr0, test_constant[i].ubr0 );
+		TEST_EQUAL( div.ubr1, test_constant[i].ubr1 );
+		TEST_EQUAL( div.umctl, test_constant[i].umctl );
+	}
+}
+
+static void test_clamp( void )
+{
+	usart_divider_t div;
+
+	/* 80000 does not fit UBR. */
+	usart_calcDivider( 8000000, 100, &div );
+	TEST_EQUAL( div.ubr0 | ( div.ubr1 << 8 ), USART_UBR_MAX );
+	TEST_EQUAL( div.umctl, 0 );
+
+	/* The largest divider that fits, with its modulation. */
+	usart_calcDivider( 0xFFFFUL * 1000 + 500, 1000, &div );
+	TEST_EQUAL( div.ubr0 | ( div.ubr1 << 8 ), 0xFFFF );
+	TEST_EQUAL( test_bits( div.umctl ), 4 );
+
+	usart_calcDivider( 32768, 0, &div );
+	TEST_EQUAL( div.ubr0 | ( div.ubr1 << 8 ), USART_UBR_MAX );
+	TEST_EQUAL( div.umctl, 0 );
+}
+
+int main( void )
+{
+	TEST_RUN( test_referenceTable );
+	TEST_RUN( test_dcoPresets );
+	TEST_RUN( test_macros );
+	TEST_RUN( test_clamp );
+
+	return TEST_RESULT( );
+}
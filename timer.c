@@ -1,181 +1,486 @@
 #include "timer.h"
 #include "types.h"
 #include "clock.h"
+#include "critical.h"
 #include <signal.h>
 #include <msp430.h>
 
-static timer_t* _timer_list_head;
+#define TIMER_WHEEL_MASK	( TIMER_WHEEL_SIZE - 1 )
+#define TIMER_DEFERRED_MASK	( TIMER_DEFERRED_QUEUE_SIZE - 1 )
+
+static timer_t* _timer_wheel[TIMER_WHEEL_SIZE];
 static volatile uint32_t _timer_ticks;
+static volatile uint16_t _timer_base;	/* TAR count at _timer_ticks */
+static uint16_t _timer_period;			/* TAR counts per tick */
+static uint16_t _timer_max_ticks;		/* Longest interval that fits in TAR */
+static uint16_t _timer_clock_source;
+static uint8_t _timer_divider;
+static clock_listener_t _timer_clock_listener;
+
+/* Deferred timers, queued by the interrupt and
+ * removed by timer_service( ). Single producer,
+ * single consumer: the indices are free-running. */
+static timer_t* volatile _timer_deferred[TIMER_DEFERRED_QUEUE_SIZE];
+static volatile uint8_t _timer_deferred_wpos;
+static volatile uint8_t _timer_deferred_rpos;
+static volatile uint16_t _timer_deferred_drops;
 
-static int timer_list_exists( timer_t* timer );
-static void timer_list_add( timer_t* new );
-static void timer_list_remove( timer_t* timer );
-static timer_t* timer_list_find_previous( timer_t* timer );
-static timer_t* timer_list_find_last( void );
+/* Next timer to visit in the slot walked by the interrupt.
+ * Moved past a timer that a callback stops or resets. */
+static timer_t* _timer_scan;
+
+static uint32_t timer_now( void );
+static uint16_t timer_next_expiry( void );
+static uint16_t timer_nearest( uint16_t limit );
+static void timer_program( void );
+static uint32_t timer_period_ticks( timer_t* timer );
+static void timer_setPeriod( void );
+static void timer_retime( void* user );
+static void timer_wheel_add( timer_t* new );
+static void timer_wheel_remove( timer_t* timer );
+static int timer_defer( timer_t* timer );
 
 void timer_init( uint16_t clock_source, uint8_t divider )
 {
-	/* Use TimerA to create periodic interrupts */
+	/* Use TimerA in continuous mode. CCR0 is advanced in the
+	 * interrupt to the next tick or, in tickless mode, to the
+	 * tick of the nearest timer expiry. */
 	/* Clear TimerA */
 	TACTL = TACLR;
 
 	/* Set clock divider */
 	switch( divider )
 	{
-	default:
+	default: divider = 1;	/* fall through */
 	case 1: TACTL |= ID_0; break;
 	case 2: TACTL |= ID_1; break;
 	case 4: TACTL |= ID_2; break;
 	case 8: TACTL |= ID_3; break;
 	}
+	_timer_divider = divider;
 
 	/* Set clock source */
+	_timer_clock_source = ( clock_source == SMCLK ) ? SMCLK : ACLK;
 	if( clock_source == SMCLK )
 		TACTL |= TASSEL1;
 	else
 		TACTL |= TASSEL0;	/* Default to ACLK */
 
 	/* Set Capture/Compare Register */
-	uint32_t tmr_clk = clock_get( clock_source ) / divider;
-	TACCR0 = ( TIMER_RESOLUTION_MSEC * tmr_clk ) / 1000 ;
+	timer_setPeriod( );
+	_timer_base = 0;
+	TACCR0 = _timer_period;
+
+	/* Follow changes of the clock frequency. */
+	_timer_clock_listener.callback = timer_retime;
+	clock_subscribe( &_timer_clock_listener );
 
 	/* Enable Capture/Compare Interrupt */
 	TACCTL0 = CCIE;
 
-	/* Start timer in up to CCR0 mode */
-	TACTL |= MC_1;
+	/* Start timer in continuous mode */
+	TACTL |= MC_2;
 }
 
 void timer_uninit( void )
 {
-	TACTL |= MC_0;
+	TACTL &= ~( MC0 | MC1 );
+	clock_unsubscribe( &_timer_clock_listener );
+}
+
+uint16_t timer_getClockSource( void )
+{
+	return _timer_clock_source;
 }
 
 void timer_start( timer_t* timer )
 {
-	if( timer && timer_list_exists( timer ) )
+	if( !timer )
 		return;
 
-	timer->next = NULL;
-	timer->ticks_remaining = timer->period_msec / TIMER_RESOLUTION_MSEC;
+	critical_state_t state = critical_enter( );
+
+	if( !timer->armed )
+	{
+		timer->expires = timer_now( ) + timer_period_ticks( timer );
+		timer_wheel_add( timer );
+		timer_program( );
+	}
 
-	timer_list_add( timer );
+	critical_exit( state );
 }
 
 void timer_stop( timer_t* timer )
 {
-	if( timer && timer_list_exists( timer ) )
-		timer_list_remove( timer );
+	if( !timer )
+		return;
+
+	critical_state_t state = critical_enter( );
+
+	if( timer->armed )
+	{
+		/* Stopped by a callback, see TIMERA_IRQHandler( ). */
+		if( _timer_scan == timer )
+			_timer_scan = timer->next;
+		timer_wheel_remove( timer );
+	}
+
+	/* A queued callback is skipped by timer_service( ). The
+	 * timer stays queued, so it is not queued twice if it is
+	 * started again and expires before the queue is serviced. */
+	timer->pending = 0;
+
+	critical_exit( state );
 }
 
 void timer_reset( timer_t* timer )
 {
-	timer->ticks_remaining = timer->period_msec / TIMER_RESOLUTION_MSEC;
+	if( !timer )
+		return;
+
+	critical_state_t state = critical_enter( );
+
+	if( timer->armed )
+	{
+		/* The expiry tick changes, so the timer may move to another slot. */
+		if( _timer_scan == timer )
+			_timer_scan = timer->next;
+		timer_wheel_remove( timer );
+		timer->expires = timer_now( ) + timer_period_ticks( timer );
+		timer_wheel_add( timer );
+		timer_program( );
+	}
+
+	critical_exit( state );
 }
 
-uint32_t timer_millis( void )
+unsigned long timer_millis( void )
 {
-	return ( _timer_ticks * TIMER_RESOLUTION_MSEC );
+	/* The tick counter is wider than the CPU word; read it atomically. */
+	critical_state_t state = critical_enter( );
+	uint32_t ticks = timer_now( );
+	critical_exit( state );
+
+	return ( ticks * TIMER_RESOLUTION_MSEC );
 }
 
-static int timer_list_exists( timer_t* timer )
+unsigned long timer_micros( void )
 {
-	timer_t* it = _timer_list_head;
+	/* Sample the tick counter and TAR together. */
+	critical_state_t state = critical_enter( );
+	uint32_t ticks = _timer_ticks;
+	uint16_t counts = TAR - _timer_base;
+	critical_exit( state );
 
-	for( ; it ; it = it->next )
-	{
-		if( it == timer )
-			return 1;
-	}
+	/* Not initialized. */
+	if( _timer_period == 0 )
+		return 0;
 
-	return 0;
+	return ( ticks * ( TIMER_RESOLUTION_MSEC * 1000UL ) ) +
+		( counts * ( TIMER_RESOLUTION_MSEC * 1000UL ) ) / _timer_period;
 }
 
-static void timer_list_add( timer_t* new )
+int timer_service( void )
 {
-	if( !_timer_list_head )
-	{
-		/* This is the first timer to be added. */
-		_timer_list_head = new;
-	}
-	else
+	int count = 0;
+
+	while( _timer_deferred_rpos != _timer_deferred_wpos )
 	{
-		/* Add new Timer at the end of the list. */
-		timer_t* last = timer_list_find_last( );
-		last->next = new;
+		timer_t* it = _timer_deferred[_timer_deferred_rpos & TIMER_DEFERRED_MASK];
+		_timer_deferred_rpos++;
+		it->queued = 0;
+
+		/* Stopped after it was queued. */
+		if( !it->pending )
+			continue;
+
+		/* Clear first: an expiry during the callback queues it again. */
+		it->pending = 0;
+
+		if( it->callback != NULL )
+			INSTRUMENT_CALL( &it->stats, it->callback( it->user ) );
+
+		count++;
 	}
+
+	return count;
 }
 
-static void timer_list_remove( timer_t* timer )
+uint16_t timer_getDeferredDrops( void )
 {
-	if( _timer_list_head == timer )
-	{
-		/* Removing first element of list. */
-		_timer_list_head = timer->next;
-		timer->next = 0;
-	}
-	else
+	return _timer_deferred_drops;
+}
+
+/**
+ * Returns the current tick. Includes the ticks that have elapsed since
+ * the last interrupt, which in tickless mode may be many.
+ * Must be called with interrupts disabled.
+ */
+static uint32_t timer_now( void )
+{
+	/* Not initialized. */
+	if( _timer_period == 0 )
+		return 0;
+
+	return _timer_ticks + ( uint16_t )( TAR - _timer_base ) / _timer_period;
+}
+
+/**
+ * Returns the number of ticks until the nearest timer expiry,
+ * capped to the longest interval TAR can measure.
+ */
+static uint16_t timer_next_expiry( void )
+{
+#if TIMER_TICKLESS
+	return timer_nearest( _timer_max_ticks );
+#else
+	return 1;
+#endif
+}
+
+/**
+ * Returns the number of ticks until the nearest timer expiry,
+ * no more than limit.
+ */
+static uint16_t timer_nearest( uint16_t limit )
+{
+	uint16_t best = limit;
+	uint16_t d;
+
+	/* Visit the slots in expiry order. A timer found at distance d
+	 * in the first turn of the wheel is the nearest one, otherwise
+	 * every slot is visited once and the minimum is kept, so the
+	 * time grows with the number of active timers.
+	 */
+	for( d = 1; d <= TIMER_WHEEL_SIZE && d < best; d++ )
 	{
-		timer_t* prev = timer_list_find_previous( timer );
-		prev->next = timer->next;
-		timer->next = 0;
+		timer_t* it = _timer_wheel[( _timer_ticks + d ) & TIMER_WHEEL_MASK];
+
+		for( ; it ; it = it->next )
+		{
+			uint32_t delta = it->expires - _timer_ticks;
+			if( delta < best )
+				best = delta;
+		}
 	}
+
+	return best;
 }
 
-static timer_t* timer_list_find_previous( timer_t* timer )
+/**
+ * Programs CCR0 for the next interrupt.
+ * Must be called with interrupts disabled.
+ */
+static void timer_program( void )
 {
-	timer_t* it = _timer_list_head;
+	uint16_t offset = timer_next_expiry( ) * _timer_period;
+
+	TACCR0 = _timer_base + offset;
 
-	for( ; it ; it = it->next )
+	/* TAR may have passed the deadline while it was computed. */
+	if( ( uint16_t )( TAR - _timer_base ) >= offset )
+		TACCTL0 |= CCIFG;
+}
+
+/**
+ * Computes the tick period in TAR counts from the timer clock.
+ */
+static void timer_setPeriod( void )
+{
+	uint32_t tmr_clk = clock_get( _timer_clock_source ) / _timer_divider;
+	_timer_period = ( TIMER_RESOLUTION_MSEC * tmr_clk ) / 1000 ;
+	if( _timer_period == 0 )
+		_timer_period = 1;
+
+	/* Keep half of the TAR range as margin for late interrupts. */
+	_timer_max_ticks = 0x8000 / _timer_period;
+	if( _timer_max_ticks == 0 )
+		_timer_max_ticks = 1;
+}
+
+/**
+ * Clock listener: recomputes the tick period when the
+ * timer clock frequency changes. The counts of the current
+ * tick are rescaled to the new period, so that the time
+ * stays monotonic across the change.
+ */
+static void timer_retime( void* user )
+{
+	( void )user;
+	critical_state_t state = critical_enter( );
+
+	uint16_t period = _timer_period;
+	timer_setPeriod( );
+
+	if( period != _timer_period )
 	{
-		if( it->next == timer )
-			return it;
+		uint16_t now = TAR;
+		uint16_t elapsed = now - _timer_base;
+		uint16_t ticks = elapsed / period;
+		uint16_t next = timer_next_expiry( );
+		uint32_t counts;
+
+		/* In tickless mode whole ticks may have elapsed since the last
+		 * interrupt. Account for those before the next expiry at the old
+		 * period; the rest are processed by the interrupt.
+		 */
+		if( ticks >= next )
+			ticks = next - 1;
+		_timer_ticks += ticks;
+		_timer_base += ticks * period;
+		elapsed -= ticks * period;
+
+		/* Rescale the remaining counts to the new period. */
+		counts = ( ( uint32_t )elapsed * _timer_period ) / period;
+		if( counts > 0x8000 )
+			counts = 0x8000;
+		_timer_base = now - ( uint16_t )counts;
+
+		timer_program( );
 	}
 
-	return NULL;
+	critical_exit( state );
+}
+
+static uint32_t timer_period_ticks( timer_t* timer )
+{
+	int ticks = timer->period_msec / TIMER_RESOLUTION_MSEC;
+
+	/* A timer expires no earlier than the next tick. */
+	if( ticks < 1 )
+		ticks = 1;
+
+	return ticks;
 }
 
-static timer_t* timer_list_find_last( void )
+static void timer_wheel_add( timer_t* new )
 {
-	timer_t* it = _timer_list_head;
+	timer_t** slot = &_timer_wheel[new->expires & TIMER_WHEEL_MASK];
+
+	/* Add new Timer at the start of its slot. */
+	new->prev = NULL;
+	new->next = *slot;
+	if( *slot )
+		( *slot )->prev = new;
+	*slot = new;
 
-	for( ; it ; it = it->next )
+	new->armed = 1;
+}
+
+static void timer_wheel_remove( timer_t* timer )
+{
+	if( timer->prev )
+		timer->prev->next = timer->next;
+	else
+		_timer_wheel[timer->expires & TIMER_WHEEL_MASK] = timer->next;	/* Removing first element of slot. */
+
+	if( timer->next )
+		timer->next->prev = timer->prev;
+
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->armed = 0;
+}
+
+/**
+ * Queues a deferred timer for timer_service( ), unless it is
+ * already queued. Returns 1 if the timer is queued.
+ * Called from the interrupt.
+ */
+static int timer_defer( timer_t* timer )
+{
+	if( !timer->queued )
 	{
-		if( it->next == NULL )
-			return it;
+		if( ( uint8_t )( _timer_deferred_wpos - _timer_deferred_rpos ) >= TIMER_DEFERRED_QUEUE_SIZE )
+		{
+			_timer_deferred_drops++;
+			return 0;
+		}
+
+		timer->queued = 1;
+		_timer_deferred[_timer_deferred_wpos & TIMER_DEFERRED_MASK] = timer;
+		_timer_deferred_wpos++;
 	}
 
-	return NULL;
+	timer->pending = 1;
+
+	return 1;
 }
 
-__attribute__ ( ( interrupt ( TIMERA0_VECTOR ) ) )
+__attribute__( ( __interrupt__( TIMERA0_VECTOR ) ) )
 void TIMERA_IRQHandler( void )
 {
-	timer_t* it = _timer_list_head;
+	timer_t* it;
+	timer_t** slot;
+	int wakeup = 0;
+	uint16_t elapsed;
+	uint32_t now;
 
-	/* Used for delay function. */
-	_timer_ticks++;
+	INSTRUMENT_ISR_ENTER( INSTRUMENT_ISR_TIMERA );
 
-	for( ; it ; it = it->next )
+	/* Process the ticks that have elapsed since the last interrupt.
+	 * This is a single tick, unless in tickless mode; then the ticks
+	 * without an expiry are skipped, so the time spent does not grow
+	 * with the ticks elapsed.
+	 */
+	while( ( elapsed = ( uint16_t )( TAR - _timer_base ) / _timer_period ) != 0 )
 	{
-		it->ticks_remaining--;
-		if( it->ticks_remaining <= 0 )
+		uint16_t skip = timer_nearest( elapsed );
+
+		_timer_base += skip * _timer_period;
+
+		/* Used for delay function. */
+		now = _timer_ticks + skip;
+		_timer_ticks = now;
+
+		/* Only the timers hashed into the current slot can expire
+		 * on this tick. The others in the slot are due on a later
+		 * turn of the wheel.
+		 */
+		slot = &_timer_wheel[now & TIMER_WHEEL_MASK];
+
+		/* Walk the slot once. A callback may start or stop any timer,
+		 * including this slot's: timers added during the walk go to
+		 * the head of their slot and expire on a later tick, so they
+		 * are not visited, and a removed timer moves the walk past it.
+		 */
+		for( it = *slot ; it ; it = _timer_scan )
 		{
-			/* Timer has expired. Invoke callback
-			 * and reset/remove as necessary.
+			_timer_scan = it->next;
+
+			if( it->expires != now )
+				continue;
+
+			/* Timer has expired. Reschedule/remove as
+			 * necessary and invoke callback.
 			 */
-			if( it->callback != NULL )
-				it->callback( it->user );
+			timer_wheel_remove( it );
 
-			if( it->mode == TIMER_MODE_PERIODIC )
+			if( !( it->mode & TIMER_MODE_ONESHOT ) )
 			{
-				timer_reset( it );
+				it->expires = now + timer_period_ticks( it );
+				timer_wheel_add( it );
 			}
-			else
+
+			if( it->mode & TIMER_MODE_WAKEUP )
+				wakeup = 1;
+
+			if( it->mode & TIMER_MODE_DEFERRED )
 			{
-				timer_list_remove( it );
+				/* Wake up the main loop to call timer_service( ). */
+				if( timer_defer( it ) )
+					wakeup = 1;
 			}
+			else if( it->callback != NULL )
+				INSTRUMENT_CALL( &it->stats, it->callback( it->user ) );
 		}
 	}
+
+	timer_program( );
+
+	INSTRUMENT_ISR_EXIT( INSTRUMENT_ISR_TIMERA );
+
+	if( wakeup )
+		__bic_SR_register_on_exit( LPM3_bits );
 }
 
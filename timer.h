@@ -8,24 +8,39 @@
  * is the timer’s period. Put simply, the timer's callback function
  * is executed when the timer's period expires.
  *
- * This module maintains a linked list of the software timers that
- * have been started. Hardware Timer0 is used to keep track of when
- * a software timer expires. This minimizes the hardware resources
- * used in the micro-controller to only one hardware timer.
+ * This module maintains a timing wheel of the software timers that
+ * have been started. Each started timer is hashed into a wheel slot
+ * by its expiry tick, so that on every tick only the timers of the
+ * current slot are examined: about 1 / @ref TIMER_WHEEL_SIZE of the
+ * active timers, if their expiries are spread out. The time of a tick
+ * still grows with the number of active timers, and with the timers
+ * that share its slot.
+ * Hardware Timer0 is used to keep track of when a software timer
+ * expires. This minimizes the hardware resources used in the
+ * micro-controller to only one hardware timer.
  *
  * The software timer supports two modes:
  * 1) Periodic: the timer expires and restarts.
  * 2) One-shot: the timer expires and stops.
  *
- * This module also provides a facility for microsecond delay.
+ * The callback is called from the timer interrupt, unless the timer is
+ * deferred, see @ref TIMER_MODE_DEFERRED.
  *
- * @warning For the microsecond delay to work correctly, sufficient
- * timer resolution must be configured in the @ref TIMER_RESOLUTION_USEC
+ * This module also provides a microsecond timebase, see
+ * @ref timer_micros( ), which is used for microsecond delays.
+ *
+ * @warning The resolution of the microsecond timebase is one period of
+ * the hardware timer clock. For it to be useful, a sufficiently fast clock
+ * source and divider must be configured in @ref timer_init( ).
  *
  * @warning The software timer structure must not be destroyed after the
  * timer is started. It is usually a global variable. This module does not
  * maintain copies of the structures passed to it.
  *
+ * @warning The private members of the structure must be zero before the
+ * timer is started for the first time. Global and static structures are
+ * zeroed at startup; local structures must be cleared by the user.
+ *
  * @Author iliaspat
  *
  */
@@ -33,6 +48,7 @@
 #define TIMER_H_
 
 #include "types.h"
+#include "instrument.h"
 
 /* Prevent clashing with timer_t in sys/types.h */
 #define __timer_t_defined
@@ -47,12 +63,59 @@
  */
 #define TIMER_MODE_ONESHOT		0x01
 
+/**
+ * Wake-up flag: can be combined with the timer mode. When the timer
+ * expires, the CPU is woken up from low power mode on exit from the
+ * timer interrupt, after the callback has been invoked.
+ */
+#define TIMER_MODE_WAKEUP		0x02
+
+/**
+ * Deferred flag: can be combined with the timer mode. When the timer
+ * expires, the interrupt only queues the timer and wakes up the CPU;
+ * the callback is called later from @ref timer_service( ), in the main
+ * loop. Use it for slow callbacks, which would otherwise delay the
+ * other interrupts. Expirations before the callback has run are
+ * coalesced into one call.
+ */
+#define TIMER_MODE_DEFERRED		0x04
+
+/**
+ * Number of deferred timers that can be queued. Must be a power of
+ * two, and at least the number of timers started with
+ * @ref TIMER_MODE_DEFERRED. Expirations that find the queue full are
+ * dropped, see @ref timer_getDeferredDrops( ).
+ */
+#ifndef TIMER_DEFERRED_QUEUE_SIZE
+#define TIMER_DEFERRED_QUEUE_SIZE	8
+#endif
+
 /**
  * This macro controls the resolution of the timer.
  * The value is in milliseconds.
  */
 #define TIMER_RESOLUTION_MSEC	1
 
+/**
+ * Number of slots in the timing wheel. Must be a power of two.
+ * Larger wheels reduce the number of timers examined per tick
+ * at the cost of 2 bytes of RAM per slot.
+ */
+#define TIMER_WHEEL_SIZE		32
+
+/**
+ * Tickless mode. When set to 1, hardware Timer0 is programmed to
+ * interrupt only when the nearest software timer expires, instead of
+ * every @ref TIMER_RESOLUTION_MSEC. This reduces the number of CPU
+ * wake-ups when the timers are idle or have long periods, but finding
+ * the nearest expiry visits up to @ref TIMER_WHEEL_SIZE slots and the
+ * timers in them, on every interrupt and every timer start.
+ * @ref timer_millis( ) remains accurate in either mode.
+ */
+#ifndef TIMER_TICKLESS
+#define TIMER_TICKLESS			0
+#endif
+
 /**
  * The software timer structure.
  * mode, period_usec, callback and user must be
@@ -60,14 +123,21 @@
  */
 typedef struct _timer
 {
-	int mode;						/**< Timer mode, one of @ref TIMER_MODE_PERIODIC or @ref TIMER_MODE_ONESHOT */
+	int mode;						/**< Timer mode, one of @ref TIMER_MODE_PERIODIC or @ref TIMER_MODE_ONESHOT, optionally with @ref TIMER_MODE_WAKEUP and @ref TIMER_MODE_DEFERRED */
 	int period_msec;				/**< The period of the timer in microsec. This is the period before the timer expires. */
 	void ( *callback )( void* );	/**< The callback fucntion to be called when the timer expires. Can be NULL. */
 	void* user;						/**< A user provided variable that is passed in the callback function. */
+#if INSTRUMENT_ENABLE
+	instrument_stats_t stats;		/**< Execution time of the callback, see @ref instrument.h. Read-only. */
+#endif
 
 	// private - do not use.
-	int ticks_remaining;
+	uint32_t expires;
+	uint8_t armed;
+	volatile uint8_t pending;		/* Expired, callback due in timer_service( ) */
+	volatile uint8_t queued;		/* In the queue of timer_service( ) */
 	struct _timer* next;
+	struct _timer* prev;
 } timer_t;
 
 /**
@@ -84,6 +154,14 @@ void timer_init( uint16_t clock_source, uint8_t divider );
  */
 void timer_uninit( void );
 
+/**
+ * Returns the clock source of the hardware Timer, as passed
+ * to @ref timer_init( ). The clock source determines the lowest
+ * power mode in which the timers keep running.
+ * @return	SMCLK or ACLK.
+ */
+uint16_t timer_getClockSource( void );
+
 /**
  * Start a software timer.
  * @param[in] timer		The timer to be started.
@@ -109,4 +187,27 @@ void timer_reset( timer_t* timer );
  */
 unsigned long timer_millis( void );
 
+/**
+ * Returns number of microseconds since start of
+ * timer. The count combines the elapsed ticks with the
+ * current hardware timer count.
+ * @return microseconds.
+ */
+unsigned long timer_micros( void );
+
+/**
+ * Calls the callbacks of the deferred timers that have expired, see
+ * @ref TIMER_MODE_DEFERRED. Call it from the main loop, e.g. after
+ * waking up from low power mode.
+ * @return Number of callbacks called.
+ */
+int timer_service( void );
+
+/**
+ * Returns the number of deferred timer expirations dropped because
+ * the queue was full, see @ref TIMER_DEFERRED_QUEUE_SIZE.
+ * @return Number of expirations dropped.
+ */
+uint16_t timer_getDeferredDrops( void );
+
 #endif
@@ -0,0 +1,40 @@
+#include "usart.h"
+#include "types.h"
+
+void usart_calcDivider( uint32_t clk, uint32_t baud, usart_divider_t* div )
+{
+	uint32_t ubr;
+	uint32_t frac;
+
+	/* The quotient can exceed the 16 bits of UBR. */
+	if( baud == 0 || ( ubr = clk / baud ) > USART_UBR_MAX )
+	{
+		div->ubr0 = ( uint8_t )( USART_UBR_MAX & 0x00FF );
+		div->ubr1 = ( uint8_t )( ( USART_UBR_MAX & 0xFF00 ) >> 8 );
+		div->umctl = 0;
+		return;
+	}
+
+	frac = clk - ubr * baud;
+
+	div->ubr0 = ( uint8_t )( ubr & 0x00FF );
+	div->ubr1 = ( uint8_t )( ( ubr & 0xFF00 ) >> 8 );
+
+	/* Accumulate the fractional part once per bit, starting from
+	 * one half to round, and set the bit on every carry. */
+	uint32_t acc = baud / 2;
+	uint8_t umctl = 0;
+	uint8_t i;
+
+	for( i = 0; i < 8; i++ )
+	{
+		acc += frac;
+		if( acc >= baud )
+		{
+			acc -= baud;
+			umctl |= ( 1 << i );
+		}
+	}
+
+	div->umctl = umctl;
+}
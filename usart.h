@@ -0,0 +1,83 @@
+/**
+ * @Brief USART baud rate generator calculations.
+ *
+ * The USART baud rate is the clock source frequency divided by
+ * UBR + m / 8, where m is the number of bits set in UMCTL. Each
+ * bit of UMCTL stretches one bit time of a character by one
+ * clock cycle, so the fractional part of the divider is spread over
+ * the character. This module computes UBR and the full UMCTL
+ * modulation pattern with integer arithmetic only. The macros
+ * evaluate to constants at compile time when the clock and baud
+ * rate are constants.
+ *
+ * @Author iliaspat
+ *
+ */
+#ifndef USART_H_
+#define USART_H_
+
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Baud rate generator settings.
+ */
+typedef struct
+{
+	uint8_t ubr0;		/**< UBR low byte. */
+	uint8_t ubr1;		/**< UBR high byte. */
+	uint8_t umctl;		/**< Modulation pattern. */
+} usart_divider_t;
+
+/** Largest divider of the baud rate generator. Slower rates are clamped to it. */
+#define USART_UBR_MAX				0xFFFF
+
+/** Integer part of the divider, unclamped. Above @ref USART_UBR_MAX for a baud rate of 0. */
+#define USART_QUOTIENT( clk, baud )																\
+	( ( baud ) == 0 ? ( uint32_t )USART_UBR_MAX + 1 : ( uint32_t )( clk ) / ( uint32_t )( baud ) )
+
+/** Integer part of the divider. */
+#define USART_UBR( clk, baud )																	\
+	( ( uint16_t )( USART_QUOTIENT( clk, baud ) > USART_UBR_MAX ? USART_UBR_MAX : USART_QUOTIENT( clk, baud ) ) )
+
+/**
+ * Modulation bit i. Set when the fractional part of the divider,
+ * accumulated over bits 0 to i and rounded, crosses an integer.
+ */
+#define USART_MOD_BIT( clk, baud, i )															\
+	( ( uint8_t )( ( ( ( ( uint32_t )( clk ) % ( baud ) ) * ( ( i ) + 1 ) + ( baud ) / 2 ) / ( baud ) -	\
+	                 ( ( ( uint32_t )( clk ) % ( baud ) ) * ( i ) + ( baud ) / 2 ) / ( baud ) ) << ( i ) ) )
+
+/** Modulation pattern. None if the divider is clamped. */
+#define USART_UMCTL( clk, baud )																\
+	( ( uint8_t )( USART_QUOTIENT( clk, baud ) > USART_UBR_MAX ? 0 :							\
+	             ( USART_MOD_BIT( clk, baud, 0 ) | USART_MOD_BIT( clk, baud, 1 ) |				\
+	               USART_MOD_BIT( clk, baud, 2 ) | USART_MOD_BIT( clk, baud, 3 ) |				\
+	               USART_MOD_BIT( clk, baud, 4 ) | USART_MOD_BIT( clk, baud, 5 ) |				\
+	               USART_MOD_BIT( clk, baud, 6 ) | USART_MOD_BIT( clk, baud, 7 ) ) ) )
+
+/**
+ * Initializer of a @ref usart_divider_t, for constant clock and baud rate.
+ * Clamped like @ref usart_calcDivider( ), also for a baud rate of 0.
+ */
+#define USART_DIVIDER( clk, baud )																\
+	{ ( uint8_t )USART_UBR( clk, baud ), ( uint8_t )( USART_UBR( clk, baud ) >> 8 ), USART_UMCTL( clk, baud ) }
+
+/**
+ * Computes the baud rate generator settings.
+ * Same result as @ref USART_DIVIDER( ), at run-time. A rate too slow
+ * for the clock, or 0, gets the largest divider, @ref USART_UBR_MAX.
+ * @param[in] clk		Frequency of the USART clock source, in Hz.
+ * @param[in] baud		Baud rate, or SPI clock rate, in Hz.
+ * @param[out] div		Stores the settings.
+ */
+void usart_calcDivider( uint32_t clk, uint32_t baud, usart_divider_t* div );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif